@@ -3,27 +3,230 @@
  * 
  * This implementation provides a generic hash table that can store key-value
  * pairs with string keys and values of any type (using void pointers).
- * It handles collisions using linked lists (chaining).
+ * It handles collisions using linked lists (chaining), and grows (or
+ * optionally shrinks) the bucket array automatically to keep chains short.
  */
 
 //1. Required Header Files
 #include <stdio.h>      // For standard I/O operations
 #include <stdlib.h>     // For memory allocation (malloc, free)
-#include <string.h>     // For string operations (strcmp, strdup)
+#include <stddef.h>     // For size_t and offsetof
+#include <stdint.h>     // For fixed-width integers (uint64_t) used by the hash functions
+#include <string.h>     // For string operations (strlen, memcmp, strdup)
 #include <stdbool.h>    // For boolean data type (true, false)
+#include <limits.h>     // For INT_MAX (upper bound on the bucket count)
+#include <time.h>       // For clock_gettime (entry expiry)
+
+// Default resize thresholds (see setLoadFactorThresholds)
+#define DEFAULT_MAX_LOAD_FACTOR 0.75  // Grow once the table is three quarters full
+#define DEFAULT_MIN_LOAD_FACTOR 0.0   // Shrinking is disabled unless requested
+#define DEFAULT_REHASH_STEP 1         // Buckets migrated per operation during an incremental rehash
+#define MAX_POWER_OF_TWO_CAPACITY (1 << 30) // Largest power of two that fits in an int capacity
+
+// Node layout
+#define CACHE_LINE_SIZE 64                  // Pooled nodes start on a line and fill it exactly
+#define NODE_META_BYTES CACHE_LINE_SIZE     // Room in front of a node for its EntryMeta (cache and TTL tables only)
+#define INLINE_KEY_CAPACITY 24              // Keys shorter than this are stored inside the node
+
+// Node pool sizing (see enableNodePool)
+#define NODE_POOL_CHUNK_NODES 1024          // KeyValuePairs carved from each node chunk
+#define KEY_ARENA_CHUNK_BYTES (64 * 1024)   // Bytes per key arena chunk
+
+// Cache mode (see setCacheLimits and setEvictionPolicy)
+#define QUEUE_MAIN 0                        // The entry is on the main list
+#define QUEUE_SMALL 1                       // The entry is on S3-FIFO's small queue or W-TinyLFU's window
+#define SKETCH_DEPTH 4                      // Rows of W-TinyLFU's count-min sketch
+
+// Entry expiry (see setExpire)
+#define EXPIRY_TICK_MS 8                    // Timer wheel resolution
+#define EXPIRY_WHEEL_SLOTS 4096             // Ticks per turn of the wheel (about 33 seconds)
+#define EXPIRY_DEFAULT_BUDGET_US 1000       // Time slice of one activeExpireCycle() call
+
+// Batched lookups (see getBatch)
+#define BATCH_GROUP_SIZE 16                 // Lookups kept in flight at once
 
 /**
  * KeyValuePair Structure
  * 
  * This structure represents a single key-value pair in our hash table.
  * We use a linked list approach to handle collisions (when multiple keys hash to the same bucket).
+ * 
+ * Keys shorter than INLINE_KEY_CAPACITY bytes are copied into inlineKey and
+ * key points there, so comparing them touches no memory outside the node.
+ * Longer keys are copied to a separate allocation. On 64-bit platforms
+ * the node is exactly 64 bytes, all of them read by a chain walk; the
+ * cache and expiry bookkeeping that only some tables need lives in an
+ * EntryMeta in front of the node (see entryMeta).
  */
 typedef struct KeyValuePair {
-    char* key;                  // The string key (we store a copy of the original)
-    void* value;                // A pointer to the value (can be any data type)
     struct KeyValuePair* next;  // Pointer to the next KeyValuePair in case of collision
+    uint64_t hash;              // The full hash of the key, so it never has to be recomputed
+    size_t keyLength;           // The length of the key (without the terminating NUL)
+    char* key;                  // The string key (inlineKey, or a heap copy for long keys)
+    void* value;                // A pointer to the value (can be any data type)
+    char inlineKey[INLINE_KEY_CAPACITY]; // Storage for short keys, including the NUL
 } KeyValuePair;
 
+/**
+ * EntryMeta Structure
+ * 
+ * The per-entry bookkeeping of cache mode and entry expiry. Only tables
+ * that use one of them allocate it: such a table reserves NODE_META_BYTES
+ * in front of each node, so a plain table's nodes stay one cache line each
+ * and the metadata of a bounded or TTL table sits on the line before its
+ * node's.
+ */
+typedef struct EntryMeta {
+    struct KeyValuePair* lruPrev; // The next newer entry on its cache list (bounded tables only)
+    struct KeyValuePair* lruNext; // The next older entry on its cache list (bounded tables only)
+    uint32_t charge;            // The bytes this entry counts against the cache's budget
+    uint8_t frequency;          // Recent hits, as counted by the eviction policy
+    uint8_t queue;              // The cache list the entry is on (QUEUE_MAIN or QUEUE_SMALL)
+    uint64_t expireAt;          // When the entry expires, in expiry clock milliseconds (0: never)
+    struct KeyValuePair* timerPrev; // The previous entry in its timer wheel slot
+    struct KeyValuePair* timerNext; // The next entry in its timer wheel slot
+} EntryMeta;
+
+_Static_assert(sizeof(EntryMeta) <= NODE_META_BYTES, "EntryMeta must fit in front of a node");
+
+// The bookkeeping of a node of a table with nodeMeta set
+static inline EntryMeta* entryMeta(const KeyValuePair* pair) {
+    return (EntryMeta*)((char*)pair - NODE_META_BYTES);
+}
+
+/**
+ * PoolChunk Structure
+ * 
+ * A large block of memory that a NodePool carves nodes or keys from.
+ * Chunks are linked together so they can all be freed at once.
+ */
+typedef struct PoolChunk {
+    struct PoolChunk* next;     // The previously allocated chunk
+    _Alignas(CACHE_LINE_SIZE) unsigned char data[]; // The usable memory, starting on a cache line
+} PoolChunk;
+
+/**
+ * NodePool Structure
+ * 
+ * An optional per-table slab allocator. KeyValuePairs are carved from
+ * chunks of NODE_POOL_CHUNK_NODES nodes, and deleted nodes are kept on a
+ * free list for reuse. Long keys are copied into a bump-pointer arena.
+ * Nothing is returned to malloc until the table itself is freed.
+ */
+typedef struct NodePool {
+    PoolChunk* nodeChunks;      // Every chunk nodes have been carved from
+    KeyValuePair* freeNodes;    // Recycled nodes, linked through their next field
+    unsigned char* nextNode;    // The next never-used node block of the newest chunk
+    size_t nodesLeft;           // The number of never-used node blocks left in the newest chunk
+    size_t nodeBytes;           // The size of a node block (the node plus any EntryMeta)
+    PoolChunk* keyChunks;       // Every chunk keys have been copied into
+    char* keyCursor;            // Where the next key goes in the newest key chunk
+    size_t keyBytesLeft;        // The number of bytes left in the newest key chunk
+} NodePool;
+
+/**
+ * Reports how many bytes a value occupies, for a cache's byte budget
+ * 
+ * @param value A value stored in the table (NULL for a key inserted by findOrInsert())
+ * @return The number of bytes to charge for it
+ */
+typedef size_t (*ValueSizeFunction)(const void* value);
+
+/**
+ * Receives each entry a bounded table evicts, so its value can be freed
+ * 
+ * @param key The key (NUL-terminated; only valid during the call)
+ * @param length The length of the key
+ * @param value The evicted entry's value
+ * @param context The context passed to setCacheLimits()
+ */
+typedef void (*EvictionCallback)(const char* key, size_t length, void* value, void* context);
+
+/**
+ * EvictionPolicy Enumeration
+ * 
+ * How a table in cache mode picks the entries it evicts (see setEvictionPolicy).
+ */
+typedef enum EvictionPolicy {
+    EVICT_LRU,          // Exact LRU: every hit moves the entry to the front of the list
+    EVICT_CLOCK,        // CLOCK: a hit sets a reference bit, the hand gives a second chance
+    EVICT_S3FIFO,       // S3-FIFO: a small probation FIFO, a main FIFO and a ghost array
+    EVICT_TINYLFU       // W-TinyLFU: a small window, then admission by a frequency sketch
+} EvictionPolicy;
+
+/**
+ * CacheState Structure
+ * 
+ * The limits and eviction lists of a table in cache mode (see
+ * setCacheLimits). Every entry is linked into one of two doubly linked
+ * lists through its lruPrev and lruNext fields, newest first: the main
+ * list, or the small list that S3-FIFO uses for probation and W-TinyLFU
+ * as its window.
+ */
+typedef struct CacheState {
+    EvictionPolicy policy;      // How victims are chosen (EVICT_LRU by default)
+    KeyValuePair* head;         // The newest (for LRU: most recently used) entry of the main list
+    KeyValuePair* tail;         // The oldest entry of the main list: the next candidate for eviction
+    KeyValuePair* smallHead;    // The newest entry of the small list
+    KeyValuePair* smallTail;    // The oldest entry of the small list
+    int smallCount;             // The number of entries on the small list
+    uint64_t* ghost;            // S3-FIFO: hashes of keys recently evicted from the small list
+    size_t ghostMask;           // The number of ghost slots minus one
+    uint8_t* sketch;            // W-TinyLFU: SKETCH_DEPTH rows of saturating 4-bit counts
+    size_t sketchMask;          // The number of counters per row minus one
+    size_t sketchAdditions;     // Counts since the sketch was last halved
+    int maxEntries;             // Evict once the table holds more entries than this (0: no limit)
+    size_t maxBytes;            // Evict once usedBytes exceeds this (0: no limit)
+    size_t usedBytes;           // The sum of the entries' charges
+    ValueSizeFunction valueSize; // Sizes values for the byte budget (NULL: values count as 0)
+    EvictionCallback onEvict;   // Called for each evicted entry (may be NULL)
+    void* context;              // Passed through to onEvict
+} CacheState;
+
+/**
+ * Returns the current time in milliseconds, for entry expiry
+ */
+typedef uint64_t (*ClockFunction)(void);
+
+/**
+ * ExpiryState Structure
+ * 
+ * The timer wheel of a table whose entries can expire (see setExpire).
+ * Every entry with an expiry time is linked through timerPrev and
+ * timerNext into the slot its expiry tick hashes to; entries due in a
+ * later turn of the wheel share the slot and are skipped until then. The
+ * active expiration cycle walks the slots tick by tick up to the present,
+ * so it only ever looks at entries that have an expiry time.
+ */
+typedef struct ExpiryState {
+    KeyValuePair* wheel[EXPIRY_WHEEL_SLOTS]; // Heads of the per-tick lists
+    uint64_t nextTick;          // The first tick the active cycle has not finished
+    size_t count;               // The number of entries with an expiry time
+    ClockFunction clock;        // The time source (monotonic milliseconds by default)
+    EvictionCallback onExpire;  // Called with each expired entry (may be NULL)
+    void* context;              // Passed through to onExpire
+} ExpiryState;
+
+/**
+ * HashFunction Type
+ * 
+ * A hash function takes the bytes of a key and their length and returns a
+ * 64-bit hash value. Any function with this signature can be plugged into a
+ * table with setHashFunction(); hashWy() and hashDjb2() are provided.
+ */
+typedef uint64_t (*HashFunction)(const void* data, size_t length);
+
+/**
+ * IndexMode Enumeration
+ * 
+ * How a 64-bit hash value is reduced to a bucket index (see setIndexMode).
+ */
+typedef enum IndexMode {
+    INDEX_MODULO,       // hash % capacity: any capacity, but costs an integer division
+    INDEX_MASK,         // hash & (capacity - 1): capacity is kept a power of two
+    INDEX_FASTRANGE     // ((hash >> 32) * capacity) >> 32: any capacity, multiply instead of divide
+} IndexMode;
+
 /**
  * HashTable Structure
  * 
@@ -34,13 +237,89 @@ typedef struct HashTable {
     int capacity;       // The number of buckets in the hash table
     KeyValuePair** array; // Array of pointers to KeyValuePair (the buckets)
     int size;           // The current number of elements stored in the hash table
+    double maxLoadFactor; // Grow when size/capacity rises above this
+    double minLoadFactor; // Shrink when size/capacity falls below this (0 disables shrinking)
+    int minCapacity;    // Shrinking never goes below the capacity the table was created with
+    bool incrementalRehash; // Spread resizes over many operations instead of doing them at once
+    int rehashStep;     // Number of non-empty buckets migrated by each operation
+    KeyValuePair** oldArray; // Bucket array being drained by an incremental rehash (NULL otherwise)
+    int oldCapacity;    // The number of buckets in oldArray
+    int rehashIndex;    // The next bucket of oldArray to migrate
+    HashFunction hashFunction; // The function used to hash keys (hashWy by default)
+    IndexMode indexMode; // How hashes are mapped to buckets (INDEX_MODULO by default)
+    NodePool* pool;     // Slab allocator for nodes and keys (NULL: use malloc directly)
+    CacheState* cache;  // Recency list and limits of a bounded table (NULL: unbounded)
+    ExpiryState* expiry; // Timer wheel for entries with a TTL (NULL until the first setExpire)
+    struct Journal* journal; // Append-only log of every change (NULL: not logged)
+    bool shard;         // Owned by a ShardedHashTable, which fixes its hash function and index mode
+    bool nodeMeta;      // Nodes carry an EntryMeta (since cache mode or expiry was first used)
 } HashTable;
 
+/**
+ * HashTableStats Structure
+ * 
+ * A summary of how evenly the keys are spread over the buckets,
+ * filled in by getHashTableStats().
+ */
+typedef struct HashTableStats {
+    int size;           // The number of elements
+    int capacity;       // The number of buckets
+    int usedBuckets;    // The number of buckets holding at least one element
+    int maxChain;       // The length of the longest chain
+    double meanChain;   // The average chain length over the non-empty buckets
+} HashTableStats;
+
+/**
+ * Computes the value upsert() stores for a key
+ * 
+ * @param value The key's current value, or NULL if it was just inserted
+ * @param exists Whether the key was already in the table
+ * @param context The context passed to upsert()
+ * @return The new value
+ */
+typedef void* (*UpsertFunction)(void* value, bool exists, void* context);
+
+/**
+ * HashTableIterator Structure
+ * 
+ * The position of an iteration started by initHashTableIterator().
+ */
+typedef struct HashTableIterator {
+    HashTable* ht;          // The table being iterated
+    int bucket;             // The next bucket to visit
+    bool inOldArray;        // Whether bucket refers to the old array of a pending rehash
+    KeyValuePair* current;  // The next entry of the current chain
+} HashTableIterator;
+
+/**
+ * Receives each entry visited by scanHashTable()
+ * 
+ * @param key The key (NUL-terminated, owned by the table)
+ * @param length The length of the key
+ * @param value The entry's value
+ * @param context The context passed to scanHashTable()
+ */
+typedef void (*ScanFunction)(const char* key, size_t length, void* value, void* context);
+
+#define SCAN_FAILED UINT64_MAX  // Returned by scanHashTable() for a table that is not in mask mode
+
+/**
+ * HashTableEntry Structure
+ * 
+ * One key-value pair handed to bulkLoad().
+ */
+typedef struct HashTableEntry {
+    const void* key;    // The key bytes (need not be NUL-terminated)
+    size_t keyLength;   // The number of bytes in the key
+    void* value;        // A pointer to the value
+} HashTableEntry;
+
 /**
  * Hash Function (djb2 algorithm)
  * 
  * This function converts a string key into a numeric hash value.
  * A good hash function distributes keys uniformly across the hash table.
+ * Kept for existing callers; tables hash with their own hashFunction.
  * 
  * @param key The string key to hash
  * @return The numeric hash value
@@ -61,19 +340,191 @@ unsigned long hash(const char* key) {
     return hash;
 }
 
+/**
+ * Hash Function (djb2 algorithm, length-aware)
+ * 
+ * The same algorithm as hash(), with the HashFunction signature so it can
+ * be selected for a table. It consumes one byte per step, which makes it
+ * slow on long keys, and the low bits of the result are poorly mixed.
+ * 
+ * @param data The key bytes
+ * @param length The number of bytes in the key
+ * @return The numeric hash value
+ */
+uint64_t hashDjb2(const void* data, size_t length) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t hash = 5381;
+    for (size_t i = 0; i < length; i++) {
+        hash = ((hash << 5) + hash) + p[i];
+    }
+    return hash;
+}
+
+// Constants of the wyhash family (odd 64-bit numbers with balanced bits)
+#define WY_P0 0xa0761d6478bd642fULL
+#define WY_P1 0xe7037ed1a0b428dbULL
+#define WY_P2 0x8ebc6af09c88c6e3ULL
+#define WY_P3 0x589965cc75374cc3ULL
+
+/**
+ * Multiply two 64-bit values into 128 bits and fold the halves together
+ * 
+ * This is the mixing step of wyhash: every input bit affects many output bits.
+ */
+static inline uint64_t wyMix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+// Unaligned little-endian loads (memcpy compiles to a single mov)
+static inline uint64_t wyRead8(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t wyRead4(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * Hash Function (wyhash)
+ * 
+ * A word-at-a-time hash: keys of up to 16 bytes are read with at most four
+ * loads and no loop, longer keys are consumed 16 bytes per step (48 bytes
+ * per step with three independent lanes for keys over 48 bytes). Every step
+ * ends in a 64x64->128 bit multiply, so all output bits - including the low
+ * bits kept by getIndex() - depend on every input byte.
+ * 
+ * @param data The key bytes
+ * @param length The number of bytes in the key
+ * @return The numeric hash value
+ */
+uint64_t hashWy(const void* data, size_t length) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t seed = wyMix(WY_P0, WY_P1);
+    uint64_t a, b;
+
+    if (length <= 16) {
+        if (length >= 4) {
+            // Two overlapping 4-byte reads from each end cover 4..16 bytes
+            size_t shift = (length >> 3) << 2;
+            a = (wyRead4(p) << 32) | wyRead4(p + shift);
+            b = (wyRead4(p + length - 4) << 32) | wyRead4(p + length - 4 - shift);
+        } else if (length > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        size_t remaining = length;
+        if (remaining > 48) {
+            // Three independent lanes keep the multiplier busy
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = wyMix(wyRead8(p) ^ WY_P1, wyRead8(p + 8) ^ seed);
+                seed1 = wyMix(wyRead8(p + 16) ^ WY_P2, wyRead8(p + 24) ^ seed1);
+                seed2 = wyMix(wyRead8(p + 32) ^ WY_P3, wyRead8(p + 40) ^ seed2);
+                p += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (remaining > 16) {
+            seed = wyMix(wyRead8(p) ^ WY_P1, wyRead8(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+        // The last 16 bytes (possibly overlapping the previous step)
+        a = wyRead8(p + remaining - 16);
+        b = wyRead8(p + remaining - 8);
+    }
+
+    a ^= WY_P1;
+    b ^= seed;
+    __uint128_t product = (__uint128_t)a * b;
+    a = (uint64_t)product;
+    b = (uint64_t)(product >> 64);
+    return wyMix(a ^ WY_P0 ^ length, b ^ WY_P1);
+}
+
+// Reverse the order of the 64 bits of a value
+static inline uint64_t reverseBits(uint64_t x) {
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+    return __builtin_bswap64(x);
+}
+
+/**
+ * Convert a hash value to an index for a given number of buckets
+ * 
+ * Needed on its own (rather than through getIndex) while an incremental
+ * rehash is in progress, when the old and the new bucket arrays have
+ * different sizes, and whenever the hash is already known.
+ * 
+ * The mask mode relies on the low bits of the hash, so it should be paired
+ * with a well-mixed function such as hashWy; with hashDjb2 similar keys
+ * end up in neighbouring or identical buckets. The fast-range mode
+ * (Lemire's multiply-shift) uses the high bits instead and works for any
+ * capacity below 2^32.
+ * 
+ * @param ht The hash table (for its index mode)
+ * @param hashValue The hash of the key
+ * @param capacity The number of buckets
+ * @return The index of the bucket
+ */
+static int indexFor(const HashTable* ht, uint64_t hashValue, int capacity) {
+    switch (ht->indexMode) {
+        case INDEX_MASK:
+            return (int)(hashValue & (uint64_t)(capacity - 1));
+        case INDEX_FASTRANGE:
+            return (int)(((hashValue >> 32) * (uint64_t)capacity) >> 32);
+        case INDEX_MODULO:
+        default:
+            return (int)(hashValue % (uint64_t)capacity);
+    }
+}
+
 /**
  * Get the index in the hash table's array
  * 
  * This function converts a hash value to an index within the capacity of our table.
- * We use the modulo operation to ensure the index is within our array bounds.
+ * By default we use the modulo operation to ensure the index is within our array
+ * bounds; see setIndexMode() for the division-free alternatives.
  * 
  * @param ht The hash table
  * @param key The string key to find the index for
  * @return The index in the hash table array where this key belongs
  */
 int getIndex(HashTable* ht, const char* key) {
-    unsigned long hashValue = hash(key);
-    return hashValue % ht->capacity;  // Ensure index is within array bounds
+    uint64_t hashValue = ht->hashFunction(key, strlen(key));
+    return indexFor(ht, hashValue, ht->capacity);  // Ensure index is within array bounds
+}
+
+/**
+ * Round a requested capacity to one the index mode can use
+ * 
+ * The mask mode needs a power of two; the other modes accept any capacity.
+ * 
+ * @param ht The hash table (for its index mode)
+ * @param capacity The requested number of buckets
+ * @return The number of buckets to allocate
+ */
+static int roundCapacity(const HashTable* ht, int capacity) {
+    if (ht->indexMode != INDEX_MASK) {
+        return capacity;
+    }
+    int rounded = 1;
+    while (rounded < capacity && rounded < MAX_POWER_OF_TWO_CAPACITY) {
+        rounded *= 2;
+    }
+    return rounded;
 }
 
 /**
@@ -86,6 +537,11 @@ int getIndex(HashTable* ht, const char* key) {
  * @return A pointer to the newly created hash table, or NULL if allocation fails
  */
 HashTable* createHashTable(int capacity) {
+    // A table needs at least one bucket, otherwise getIndex() would divide by zero
+    if (capacity < 1) {
+        capacity = 1;
+    }
+
     // Allocate memory for the hash table structure
     HashTable* ht = (HashTable*)malloc(sizeof(HashTable));
     if (ht == NULL) {
@@ -95,6 +551,22 @@ HashTable* createHashTable(int capacity) {
     // Initialize the hash table fields
     ht->capacity = capacity;
     ht->size = 0;
+    ht->maxLoadFactor = DEFAULT_MAX_LOAD_FACTOR;
+    ht->minLoadFactor = DEFAULT_MIN_LOAD_FACTOR;
+    ht->minCapacity = capacity;
+    ht->incrementalRehash = false;
+    ht->rehashStep = DEFAULT_REHASH_STEP;
+    ht->oldArray = NULL;
+    ht->oldCapacity = 0;
+    ht->rehashIndex = 0;
+    ht->hashFunction = hashWy;
+    ht->indexMode = INDEX_MODULO;
+    ht->pool = NULL;
+    ht->cache = NULL;
+    ht->expiry = NULL;
+    ht->journal = NULL;
+    ht->shard = false;
+    ht->nodeMeta = false;
     
     // Allocate memory for the array of buckets
     ht->array = (KeyValuePair**)malloc(capacity * sizeof(KeyValuePair*));
@@ -112,204 +584,6709 @@ HashTable* createHashTable(int capacity) {
 }
 
 /**
- * Insert a key-value pair into the hash table
- * 
- * If the key already exists, its value is updated.
- * Otherwise, a new key-value pair is created.
+ * The bytes a table allocates per node: the node itself, plus room for an
+ * EntryMeta in front of it once the table uses cache mode or expiry
+ */
+static size_t nodeBlockBytes(const HashTable* ht) {
+    return sizeof(KeyValuePair) + (ht->nodeMeta ? NODE_META_BYTES : 0);
+}
+
+/**
+ * Allocate a new chunk and push it onto a chunk list
  * 
- * @param ht The hash table
- * @param key The string key
- * @param value Pointer to the value to store
- * @return true if insertion was successful, false otherwise
+ * @param list The chunk list of the pool
+ * @param bytes The number of usable bytes needed
+ * @return The usable memory of the new chunk, or NULL if allocation fails
  */
-bool insert(HashTable* ht, const char* key, void* value) {
-    // Calculate which bucket this key belongs in
-    int index = getIndex(ht, key);
+static void* poolAddChunk(PoolChunk** list, size_t bytes) {
+    // Cache-line aligned, so that pooled nodes never straddle two lines
+    size_t total = (sizeof(PoolChunk) + bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+    PoolChunk* chunk = (PoolChunk*)aligned_alloc(CACHE_LINE_SIZE, total);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->next = *list;
+    *list = chunk;
+    return chunk->data;
+}
 
-    // Check if the key already exists in the table
-    KeyValuePair* current = ht->array[index];
-    while (current != NULL) {
-        if (strcmp(current->key, key) == 0) {
-            // Key found: update the value and return
-            current->value = value;
-            return true;
-        }
-        current = current->next;
+/**
+ * Free every chunk of a chunk list
+ */
+static void poolFreeChunks(PoolChunk* chunk) {
+    while (chunk != NULL) {
+        PoolChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
+}
 
-    // Key doesn't exist: create a new key-value pair
-    KeyValuePair* newPair = (KeyValuePair*)malloc(sizeof(KeyValuePair));
-    if (newPair == NULL) {
-        return false;  // Memory allocation failed
+/**
+ * Give a table its own node pool
+ * 
+ * From then on nodes and key copies are carved out of large chunks instead
+ * of two malloc calls per insert, deleted nodes are recycled through a free
+ * list, and freeHashTable() releases a handful of chunks instead of walking
+ * every chain. The space of deleted keys is only reclaimed when the table is
+ * freed, so this suits tables that mostly grow. Only an empty table can
+ * switch allocators.
+ * 
+ * @param ht The hash table (must be empty)
+ * @return true if the pool is in use, false if the table is not empty or allocation failed
+ */
+bool enableNodePool(HashTable* ht) {
+    if (ht->pool != NULL) {
+        return true;
     }
-    
-    // Store a copy of the key (important to avoid issues if original key is modified or freed)
-    newPair->key = strdup(key);
-    if (newPair->key == NULL) {
-        free(newPair);  // Clean up if strdup fails
+    if (ht->size != 0) {
+        return false;  // Existing nodes came from malloc
+    }
+
+    NodePool* pool = (NodePool*)calloc(1, sizeof(NodePool));
+    if (pool == NULL) {
         return false;
     }
-    
-    // Set the value and link this pair at the beginning of the bucket's list
-    newPair->value = value;
-    newPair->next = ht->array[index];  // The current head becomes the next of our new pair
-    ht->array[index] = newPair;        // The new pair becomes the new head
-    ht->size++;                        // Increment the total size
-    
+    pool->nodeBytes = nodeBlockBytes(ht);
+    ht->pool = pool;
     return true;
 }
 
 /**
- * Retrieve a value from the hash table by its key
+ * Allocate a KeyValuePair (from the pool if the table has one)
  * 
- * @param ht The hash table
- * @param key The key to look up
- * @return The value associated with the key, or NULL if key not found
+ * A table with nodeMeta set gets its EntryMeta in the same block, directly
+ * in front of the node.
  */
-void* get(HashTable* ht, const char* key) {
-    // Calculate which bucket this key would be in
-    int index = getIndex(ht, key);
-    
-    // Traverse the linked list in this bucket to find the key
-    KeyValuePair* current = ht->array[index];
-    while (current != NULL) {
-        if (strcmp(current->key, key) == 0) {
-            // Key found: return its value
-            return current->value;
+static KeyValuePair* allocPair(HashTable* ht) {
+    NodePool* pool = ht->pool;
+    if (pool == NULL) {
+        unsigned char* block = (unsigned char*)malloc(nodeBlockBytes(ht));
+        if (block == NULL) {
+            return NULL;
         }
-        current = current->next;
+        return (KeyValuePair*)(block + nodeBlockBytes(ht) - sizeof(KeyValuePair));
     }
-    
-    // Key not found
-    return NULL;
+
+    // Reuse a deleted node first
+    if (pool->freeNodes != NULL) {
+        KeyValuePair* pair = pool->freeNodes;
+        pool->freeNodes = pair->next;
+        return pair;
+    }
+
+    if (pool->nodesLeft == 0) {
+        pool->nextNode = (unsigned char*)poolAddChunk(&pool->nodeChunks, NODE_POOL_CHUNK_NODES * pool->nodeBytes);
+        if (pool->nextNode == NULL) {
+            return NULL;
+        }
+        pool->nodesLeft = NODE_POOL_CHUNK_NODES;
+    }
+    KeyValuePair* pair = (KeyValuePair*)(pool->nextNode + pool->nodeBytes - sizeof(KeyValuePair));
+    pool->nextNode += pool->nodeBytes;
+    pool->nodesLeft--;
+    return pair;
 }
 
 /**
- * Delete a key-value pair from the hash table
- * 
- * @param ht The hash table
- * @param key The key to delete
- * @return true if key was found and deleted, false if key not found
+ * Give a KeyValuePair's block back (to the pool if the table has one)
  */
-bool delete(HashTable* ht, const char* key) {
-    // Calculate which bucket this key would be in
-    int index = getIndex(ht, key);
-    
-    KeyValuePair* current = ht->array[index];
-    KeyValuePair* prev = NULL;
-
-    // Traverse the linked list to find the key
-    while (current != NULL) {
-        if (strcmp(current->key, key) == 0) {
-            // Key found: remove this node from the linked list
-            if (prev == NULL) {
-                // This is the first node in the list
-                ht->array[index] = current->next;
-            } else {
-                // This is not the first node
-                prev->next = current->next;
-            }
-            
-            // Free the memory used by this key-value pair
-            free(current->key);  // Free the duplicated key string
-            free(current);       // Free the KeyValuePair structure
-            ht->size--;          // Decrease the total size
-            
-            return true;  // Successfully deleted
-        }
-        
-        // Move to the next node
-        prev = current;
-        current = current->next;
+static void freeNode(HashTable* ht, KeyValuePair* pair) {
+    if (ht->pool != NULL) {
+        pair->next = ht->pool->freeNodes;
+        ht->pool->freeNodes = pair;
+    } else {
+        free((unsigned char*)pair + sizeof(KeyValuePair) - nodeBlockBytes(ht));
     }
-    
-    // Key not found
-    return false;
 }
 
 /**
- * Free all memory used by the hash table
- * 
- * @param ht The hash table to free
+ * Allocate room for a key copy of the given length plus its terminating NUL
  */
-void freeHashTable(HashTable* ht) {
-    if (ht == NULL) return;
+static char* allocKey(HashTable* ht, size_t length) {
+    NodePool* pool = ht->pool;
+    size_t bytes = length + 1;
+    if (pool == NULL) {
+        return (char*)malloc(bytes);
+    }
 
-    // Free all KeyValuePair nodes in all buckets
-    for (int i = 0; i < ht->capacity; i++) {
-        KeyValuePair* current = ht->array[i];
-        while (current != NULL) {
-            KeyValuePair* next = current->next;
-            free(current->key);  // Free the key string
-            free(current);       // Free the KeyValuePair structure
-            current = next;
+    // Keys longer than a whole chunk get a chunk of their own
+    if (bytes > KEY_ARENA_CHUNK_BYTES) {
+        return (char*)poolAddChunk(&pool->keyChunks, bytes);
+    }
+    if (bytes > pool->keyBytesLeft) {
+        pool->keyCursor = (char*)poolAddChunk(&pool->keyChunks, KEY_ARENA_CHUNK_BYTES);
+        if (pool->keyCursor == NULL) {
+            pool->keyBytesLeft = 0;
+            return NULL;
         }
+        pool->keyBytesLeft = KEY_ARENA_CHUNK_BYTES;
     }
-    
-    // Free the array of buckets and the hash table structure itself
-    free(ht->array);
-    free(ht);
+
+    char* key = pool->keyCursor;
+    pool->keyCursor += bytes;
+    pool->keyBytesLeft -= bytes;
+    return key;
 }
 
 /**
- * Print the contents of the hash table (for debugging)
+ * Make sure the pool can hand out count nodes and keyBytes of key copies
+ * without another allocation
  * 
- * @param ht The hash table to print
+ * Whatever a reservation does not use stays in the pool for later inserts.
+ * If the current chunk is too small, its remainder is abandoned for one
+ * chunk that fits the whole batch.
+ * 
+ * @return false if a chunk could not be allocated
  */
-void printHashTable(HashTable* ht) {
-    printf("Hash Table (size: %d, capacity: %d)\n", ht->size, ht->capacity);
-    
-    for (int i = 0; i < ht->capacity; i++) {
-        KeyValuePair* current = ht->array[i];
-        if (current != NULL) {
-            printf("  Bucket %d:", i);
-            while (current != NULL) {
-                printf(" [%s]->", current->key);
-                current = current->next;
-            }
-            printf("NULL\n");
+static bool poolReserve(NodePool* pool, size_t count, size_t keyBytes) {
+    if (count > pool->nodesLeft) {
+        size_t nodes = count > NODE_POOL_CHUNK_NODES ? count : NODE_POOL_CHUNK_NODES;
+        unsigned char* block = (unsigned char*)poolAddChunk(&pool->nodeChunks, nodes * pool->nodeBytes);
+        if (block == NULL) {
+            return false;
         }
+        pool->nextNode = block;
+        pool->nodesLeft = nodes;
     }
+    if (keyBytes > pool->keyBytesLeft) {
+        size_t bytes = keyBytes > KEY_ARENA_CHUNK_BYTES ? keyBytes : KEY_ARENA_CHUNK_BYTES;
+        char* block = (char*)poolAddChunk(&pool->keyChunks, bytes);
+        if (block == NULL) {
+            return false;
+        }
+        pool->keyCursor = block;
+        pool->keyBytesLeft = bytes;
+    }
+    return true;
 }
 
 /**
- * Example of hash table usage
+ * Create a node holding a copy of a key
+ * 
+ * @return The new node (not yet linked into a bucket), or NULL if allocation fails
  */
-/*
-int main() {
-    // Create a hash table with 10 buckets
-    HashTable* ht = createHashTable(10);
-    
-    // Define some example values (normally these would be more complex data structures)
-    int value1 = 100;
-    int value2 = 200;
-    int value3 = 300;
-    
-    // Insert key-value pairs
-    insert(ht, "key1", &value1);
-    insert(ht, "key2", &value2);
-    insert(ht, "key3", &value3);
-    
-    // Print the hash table
-    printHashTable(ht);
-    
-    // Retrieve and print a value
-    int* retrieved = (int*)get(ht, "key2");
-    if (retrieved != NULL) {
-        printf("Value for key2: %d\n", *retrieved);
+static KeyValuePair* createPair(HashTable* ht, const void* key, size_t length, uint64_t hashValue, void* value) {
+    KeyValuePair* pair = allocPair(ht);
+    if (pair == NULL) {
+        return NULL;  // Memory allocation failed
     }
-    
-    // Delete a key
-    if (delete(ht, "key1")) {
-        printf("Deleted key1\n");
+
+    // Store a copy of the key (important to avoid issues if original key is modified or freed).
+    // Short keys live inside the node itself, which saves an allocation and a cache miss.
+    pair->key = length < INLINE_KEY_CAPACITY ? pair->inlineKey : allocKey(ht, length);
+    if (pair->key == NULL) {
+        freeNode(ht, pair);  // Clean up if the copy cannot be allocated
+        return NULL;
+    }
+    memcpy(pair->key, key, length);
+    pair->key[length] = '\0';
+    pair->keyLength = length;
+    pair->hash = hashValue;
+    pair->value = value;
+    pair->next = NULL;
+    if (ht->nodeMeta) {
+        memset(entryMeta(pair), 0, sizeof(EntryMeta));
+    }
+    return pair;
+}
+
+/**
+ * Free a node that has been unlinked from its bucket
+ * 
+ * With a pool the node goes onto the free list and a long key's bytes stay
+ * in the arena; otherwise both are returned to malloc.
+ */
+static void releasePair(HashTable* ht, KeyValuePair* pair) {
+    if (ht->pool == NULL && pair->key != pair->inlineKey) {
+        free(pair->key);  // Free the duplicated key string
+    }
+    freeNode(ht, pair);   // Free the KeyValuePair structure
+}
+
+/**
+ * Give every node of a table room for an EntryMeta
+ * 
+ * Called when a table first uses cache mode or expiry. Each node is copied
+ * into a block that has its EntryMeta in front, zeroed, and the chains are
+ * relinked; a pool starts new chunks with the larger stride and drops the
+ * old ones. The new blocks are all allocated before anything moves, so a
+ * failure leaves the table as it was.
+ * 
+ * @return false if allocation failed
+ */
+static bool enableNodeMeta(HashTable* ht) {
+    if (ht->nodeMeta) {
+        return true;
+    }
+
+    NodePool* pool = ht->pool;
+    PoolChunk* oldChunks = NULL;
+    KeyValuePair* oldFreeNodes = NULL;
+    size_t oldNodesLeft = 0;
+    if (pool != NULL) {
+        // Keep the old chunks aside: the copies go into new ones
+        oldChunks = pool->nodeChunks;
+        oldFreeNodes = pool->freeNodes;
+        oldNodesLeft = pool->nodesLeft;
+        pool->nodeChunks = NULL;
+        pool->freeNodes = NULL;
+        pool->nodesLeft = 0;
+        pool->nodeBytes = sizeof(KeyValuePair) + NODE_META_BYTES;
+    }
+
+    KeyValuePair** blocks = (KeyValuePair**)malloc(((size_t)ht->size + 1) * sizeof(KeyValuePair*));
+    size_t count = 0;
+    ht->nodeMeta = true;
+    if (blocks != NULL && (pool == NULL || poolReserve(pool, (size_t)ht->size, 0))) {
+        while (count < (size_t)ht->size && (blocks[count] = allocPair(ht)) != NULL) {
+            count++;
+        }
+    }
+    if (blocks == NULL || count < (size_t)ht->size) {
+        // Put everything back the way it was
+        if (pool != NULL) {
+            poolFreeChunks(pool->nodeChunks);
+            pool->nodeChunks = oldChunks;
+            pool->freeNodes = oldFreeNodes;
+            pool->nodesLeft = oldNodesLeft;
+            pool->nodeBytes = sizeof(KeyValuePair);
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                freeNode(ht, blocks[i]);
+            }
+        }
+        ht->nodeMeta = false;
+        free(blocks);
+        return false;
+    }
+
+    size_t next = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        KeyValuePair** array = pass == 0 ? ht->array : ht->oldArray;
+        int start = pass == 0 ? 0 : ht->rehashIndex;  // Old buckets below it were migrated and are empty
+        int capacity = pass == 0 ? ht->capacity : ht->oldCapacity;
+        for (int i = start; array != NULL && i < capacity; i++) {
+            for (KeyValuePair** link = &array[i]; *link != NULL; link = &(*link)->next) {
+                KeyValuePair* old = *link;
+                KeyValuePair* pair = blocks[next++];
+                *pair = *old;
+                if (old->key == old->inlineKey) {
+                    pair->key = pair->inlineKey;
+                }
+                memset(entryMeta(pair), 0, sizeof(EntryMeta));
+                *link = pair;
+                if (pool == NULL) {
+                    free(old);  // Allocated before the table had metadata: the node is the whole block
+                }
+            }
+        }
+    }
+    if (pool != NULL) {
+        poolFreeChunks(oldChunks);
+    }
+    free(blocks);
+    return true;
+}
+
+/**
+ * Move every node of one old bucket into the current bucket array
+ * 
+ * @param ht The hash table (must be rehashing)
+ * @param i The index of the bucket in oldArray
+ */
+static void migrateBucket(HashTable* ht, int i) {
+    KeyValuePair* current = ht->oldArray[i];
+    while (current != NULL) {
+        KeyValuePair* next = current->next;
+        int index = indexFor(ht, current->hash, ht->capacity);  // The cached hash avoids rehashing the key
+        current->next = ht->array[index];
+        ht->array[index] = current;
+        current = next;
+    }
+    ht->oldArray[i] = NULL;
+}
+
+/**
+ * Perform a bounded amount of incremental rehashing
+ * 
+ * Migrates up to the given number of non-empty buckets from the old bucket
+ * array to the new one. To keep the cost of a single call bounded even when
+ * the old array is sparse, at most ten times as many empty buckets are
+ * skipped. Once the old array is drained it is freed.
+ * 
+ * @param ht The hash table
+ * @param buckets The maximum number of non-empty buckets to migrate
+ * @return true if a rehash is still in progress, false if it is complete
+ */
+bool rehashStep(HashTable* ht, int buckets) {
+    if (ht->oldArray == NULL) {
+        return false;  // Nothing to migrate
+    }
+
+    long emptyVisits = (long)buckets * 10;
+    while (buckets > 0 && ht->rehashIndex < ht->oldCapacity) {
+        if (ht->oldArray[ht->rehashIndex] == NULL) {
+            ht->rehashIndex++;
+            if (--emptyVisits == 0) {
+                break;
+            }
+            continue;
+        }
+        migrateBucket(ht, ht->rehashIndex);
+        ht->rehashIndex++;
+        buckets--;
+    }
+
+    if (ht->rehashIndex < ht->oldCapacity) {
+        return true;
+    }
+
+    // Every bucket has been migrated: drop the old array
+    free(ht->oldArray);
+    ht->oldArray = NULL;
+    ht->oldCapacity = 0;
+    ht->rehashIndex = 0;
+    return false;
+}
+
+/**
+ * Complete any incremental rehash that is in progress
+ * 
+ * @param ht The hash table
+ */
+static void finishRehash(HashTable* ht) {
+    while (rehashStep(ht, INT_MAX)) {
+        // Keep migrating until the old array is gone
+    }
+}
+
+/**
+ * Do the per-operation share of an incremental rehash, if one is running
+ * 
+ * @param ht The hash table
+ */
+static void rehashTick(HashTable* ht) {
+    if (ht->oldArray != NULL) {
+        rehashStep(ht, ht->rehashStep);
+    }
+}
+
+static bool rebuildBuckets(HashTable* ht, int newCapacity);
+
+/**
+ * Resize the hash table
+ * 
+ * Allocates a new bucket array with the given capacity and moves every
+ * KeyValuePair into it. The nodes themselves are reused (only their next
+ * pointers change), so no keys are copied and no values are touched.
+ * If the new array cannot be allocated the table is left unchanged.
+ * 
+ * In incremental mode the old array is kept alongside the new one and
+ * drained a few buckets at a time by subsequent operations (see rehashStep).
+ * A resize requested while a previous one is still running completes the
+ * previous one first.
+ * 
+ * @param ht The hash table
+ * @param newCapacity The new number of buckets
+ * @return true if the table was resized, false otherwise
+ */
+bool resizeHashTable(HashTable* ht, int newCapacity) {
+    // Only one migration can be in flight at a time
+    finishRehash(ht);
+
+    if (newCapacity < 1) {
+        return false;
+    }
+    newCapacity = roundCapacity(ht, newCapacity);
+    if (newCapacity == ht->capacity) {
+        return false;
+    }
+    return rebuildBuckets(ht, newCapacity);
+}
+
+/**
+ * Redistribute every node into a freshly allocated bucket array
+ * 
+ * The worker behind resizeHashTable(). Unlike resizeHashTable() it also
+ * accepts the current capacity, which is how the table is rebuilt after
+ * the index mode changes. Must not be called while rehashing.
+ * 
+ * @param ht The hash table
+ * @param newCapacity The new number of buckets
+ * @return true if the buckets were rebuilt, false if allocation failed
+ */
+static bool rebuildBuckets(HashTable* ht, int newCapacity) {
+    KeyValuePair** newArray = (KeyValuePair**)calloc((size_t)newCapacity, sizeof(KeyValuePair*));
+    if (newArray == NULL) {
+        return false;  // Keep using the old array
+    }
+
+    // The current array becomes the one being drained
+    ht->oldArray = ht->array;
+    ht->oldCapacity = ht->capacity;
+    ht->rehashIndex = 0;
+    ht->array = newArray;
+    ht->capacity = newCapacity;
+
+    // Stop-the-world mode: redistribute every node right now
+    if (!ht->incrementalRehash) {
+        finishRehash(ht);
+    }
+    return true;
+}
+
+/**
+ * Enable or disable incremental rehashing
+ * 
+ * When enabled, a resize only allocates the new bucket array; the nodes are
+ * then migrated bucketsPerStep non-empty buckets at a time by each insert(),
+ * get() and delete(), so no single operation pays for the whole rehash.
+ * Disabling it completes any migration that is still in progress.
+ * 
+ * @param ht The hash table
+ * @param enabled Whether resizes should be incremental
+ * @param bucketsPerStep The number of buckets each operation migrates (at least 1)
+ * @return true if the setting was applied, false if bucketsPerStep is invalid
+ */
+bool setIncrementalRehash(HashTable* ht, bool enabled, int bucketsPerStep) {
+    if (bucketsPerStep < 1) {
+        return false;
+    }
+    ht->incrementalRehash = enabled;
+    ht->rehashStep = bucketsPerStep;
+    if (!enabled) {
+        finishRehash(ht);
+    }
+    return true;
+}
+
+/**
+ * Select the hash function used by the table
+ * 
+ * Every key's bucket depends on its hash, so the table is rehashed in full
+ * (never incrementally) with the new function before this returns. The
+ * shards of a ShardedHashTable are routed by the table's own function and
+ * cannot be changed (see setShardedHashFunction).
+ * 
+ * @param ht The hash table
+ * @param hashFunction The new hash function, e.g. hashWy or hashDjb2
+ * @return true if the function was changed, false if rehashing failed or the table is a shard
+ */
+bool setHashFunction(HashTable* ht, HashFunction hashFunction) {
+    if (hashFunction == NULL) {
+        return false;
+    }
+    if (ht->shard) {
+        return hashFunction == ht->hashFunction;
+    }
+    if (hashFunction == ht->hashFunction) {
+        return true;
+    }
+
+    finishRehash(ht);
+    KeyValuePair** newArray = (KeyValuePair**)calloc((size_t)ht->capacity, sizeof(KeyValuePair*));
+    if (newArray == NULL) {
+        return false;  // The nodes are still placed by the old function
+    }
+    ht->hashFunction = hashFunction;
+
+    // The cached hashes are stale: recompute each one while relinking the node
+    for (int i = 0; i < ht->capacity; i++) {
+        KeyValuePair* current = ht->array[i];
+        while (current != NULL) {
+            KeyValuePair* next = current->next;
+            current->hash = hashFunction(current->key, current->keyLength);
+            int index = indexFor(ht, current->hash, ht->capacity);
+            current->next = newArray[index];
+            newArray[index] = current;
+            current = next;
+        }
+    }
+
+    free(ht->array);
+    ht->array = newArray;
+    return true;
+}
+
+/**
+ * Select how hash values are mapped to bucket indexes
+ * 
+ * INDEX_MASK rounds the capacity (and the minimum capacity used when
+ * shrinking) up to a power of two and replaces the division of the default
+ * INDEX_MODULO mode with a single AND. INDEX_FASTRANGE keeps the capacity
+ * as it is and uses a multiply and a shift. Changing the mode moves every
+ * key, so the table is rehashed in full before this returns. The shards
+ * of a ShardedHashTable always use INDEX_MASK.
+ * 
+ * @param ht The hash table
+ * @param mode The new index mode
+ * @return true if the mode was changed, false if rehashing failed or the table is a shard
+ */
+bool setIndexMode(HashTable* ht, IndexMode mode) {
+    if (mode == ht->indexMode) {
+        return true;
+    }
+    if (ht->shard) {
+        return false;
+    }
+
+    finishRehash(ht);
+    IndexMode previous = ht->indexMode;
+    bool incremental = ht->incrementalRehash;
+    ht->indexMode = mode;
+    ht->incrementalRehash = false;
+    bool rebuilt = rebuildBuckets(ht, roundCapacity(ht, ht->capacity));
+    ht->incrementalRehash = incremental;
+    if (!rebuilt) {
+        ht->indexMode = previous;  // The nodes are still placed by the old mode
+        return false;
+    }
+    ht->minCapacity = roundCapacity(ht, ht->minCapacity);
+    return true;
+}
+
+/**
+ * Check whether a node holds the given key
+ * 
+ * The cached hash and length are compared first; the key bytes (a separate
+ * allocation) are only read when both match, which for a decent hash
+ * function means the key is almost certainly there.
+ */
+static inline bool pairMatches(const KeyValuePair* pair, const void* key, size_t length, uint64_t hashValue) {
+    return pair->hash == hashValue && pair->keyLength == length && memcmp(pair->key, key, length) == 0;
+}
+
+/**
+ * Find the link that points to the node holding a key
+ * 
+ * Returns the address of the pointer (either a bucket head or the next
+ * field of the previous node) that refers to the matching node, so callers
+ * can both read the node and unlink it. While an incremental rehash is in
+ * progress the key may still live in the old array, so both are searched.
+ * 
+ * @param ht The hash table
+ * @param key The key to look for
+ * @param length The length of the key
+ * @param hashValue The hash of the key
+ * @return The link to the matching node, or NULL if the key is not present
+ */
+static KeyValuePair** findLink(HashTable* ht, const void* key, size_t length, uint64_t hashValue) {
+    KeyValuePair** link = &ht->array[indexFor(ht, hashValue, ht->capacity)];
+    while (*link != NULL) {
+        if (pairMatches(*link, key, length, hashValue)) {
+            return link;
+        }
+        link = &(*link)->next;
+    }
+
+    if (ht->oldArray != NULL) {
+        // Buckets that were already migrated are simply empty here
+        link = &ht->oldArray[indexFor(ht, hashValue, ht->oldCapacity)];
+        while (*link != NULL) {
+            if (pairMatches(*link, key, length, hashValue)) {
+                return link;
+            }
+            link = &(*link)->next;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Grow the table if it has become too full
+ * 
+ * Called after an insertion. The capacity is doubled so that the cost of
+ * rehashing is spread over many insertions (amortized O(1) per insert).
+ * 
+ * @param ht The hash table
+ */
+static void growIfNeeded(HashTable* ht) {
+    if (ht->oldArray != NULL) {
+        return;  // Let the running migration finish first
+    }
+    if (ht->size <= ht->capacity * ht->maxLoadFactor) {
+        return;
+    }
+    if (ht->capacity > INT_MAX / 2) {
+        return;  // Cannot double any further
+    }
+    resizeHashTable(ht, ht->capacity * 2);
+}
+
+/**
+ * Shrink the table if it has become too empty
+ * 
+ * Called after a deletion. Does nothing unless a minimum load factor was
+ * configured, and never goes below the capacity the table was created with.
+ * 
+ * @param ht The hash table
+ */
+static void shrinkIfNeeded(HashTable* ht) {
+    if (ht->minLoadFactor <= 0.0 || ht->capacity <= ht->minCapacity) {
+        return;
+    }
+    if (ht->oldArray != NULL) {
+        return;  // Let the running migration finish first
+    }
+    if (ht->size >= ht->capacity * ht->minLoadFactor) {
+        return;
+    }
+    int newCapacity = ht->capacity / 2;
+    if (newCapacity < ht->minCapacity) {
+        newCapacity = ht->minCapacity;
+    }
+    resizeHashTable(ht, newCapacity);
+}
+
+/**
+ * Configure the automatic resize thresholds
+ * 
+ * The table grows (doubles) once size/capacity exceeds maxLoadFactor, and
+ * halves once size/capacity drops below minLoadFactor. Pass 0 as
+ * minLoadFactor to never shrink. minLoadFactor must be less than half of
+ * maxLoadFactor, otherwise a shrink could immediately trigger a grow.
+ * 
+ * @param ht The hash table
+ * @param maxLoadFactor The load factor above which the table grows
+ * @param minLoadFactor The load factor below which the table shrinks
+ * @return true if the thresholds were accepted, false if they are invalid
+ */
+bool setLoadFactorThresholds(HashTable* ht, double maxLoadFactor, double minLoadFactor) {
+    if (maxLoadFactor <= 0.0 || minLoadFactor < 0.0 || minLoadFactor * 2.0 >= maxLoadFactor) {
+        return false;
+    }
+    ht->maxLoadFactor = maxLoadFactor;
+    ht->minLoadFactor = minLoadFactor;
+
+    // Apply the new thresholds right away
+    growIfNeeded(ht);
+    shrinkIfNeeded(ht);
+    return true;
+}
+
+/**
+ * Pre-size the table for an expected number of elements
+ * 
+ * Grows the bucket array once so that n elements fit without crossing the
+ * maximum load factor. Useful before bulk loads, which would otherwise pay
+ * for every intermediate doubling. Never shrinks the table.
+ * 
+ * @param ht The hash table
+ * @param n The number of elements the table should hold
+ * @return true if the table can hold n elements, false if resizing failed
+ */
+bool reserve(HashTable* ht, int n) {
+    double needed = n / ht->maxLoadFactor;
+    if (needed <= ht->capacity) {
+        return true;  // Already big enough
+    }
+    if (needed > INT_MAX) {
+        return false;
+    }
+    return resizeHashTable(ht, (int)needed + 1);
+}
+
+/**
+ * Unlink an entry from one of a cache's lists
+ */
+static void listRemove(KeyValuePair** head, KeyValuePair** tail, KeyValuePair* pair) {
+    EntryMeta* meta = entryMeta(pair);
+    if (meta->lruPrev != NULL) {
+        entryMeta(meta->lruPrev)->lruNext = meta->lruNext;
+    } else {
+        *head = meta->lruNext;
+    }
+    if (meta->lruNext != NULL) {
+        entryMeta(meta->lruNext)->lruPrev = meta->lruPrev;
+    } else {
+        *tail = meta->lruPrev;
+    }
+}
+
+/**
+ * Link an entry at the front (the newest end) of one of a cache's lists
+ */
+static void listPushFront(KeyValuePair** head, KeyValuePair** tail, KeyValuePair* pair) {
+    EntryMeta* meta = entryMeta(pair);
+    meta->lruPrev = NULL;
+    meta->lruNext = *head;
+    if (*head != NULL) {
+        entryMeta(*head)->lruPrev = pair;
+    } else {
+        *tail = pair;
+    }
+    *head = pair;
+}
+
+/**
+ * Take an entry off whichever list it is on
+ */
+static void queueRemove(CacheState* cache, KeyValuePair* pair) {
+    if (entryMeta(pair)->queue == QUEUE_SMALL) {
+        listRemove(&cache->smallHead, &cache->smallTail, pair);
+        cache->smallCount--;
+    } else {
+        listRemove(&cache->head, &cache->tail, pair);
+    }
+}
+
+/**
+ * Put an entry at the front of the main or the small list
+ */
+static void queuePush(CacheState* cache, KeyValuePair* pair, uint8_t queue) {
+    entryMeta(pair)->queue = queue;
+    if (queue == QUEUE_SMALL) {
+        listPushFront(&cache->smallHead, &cache->smallTail, pair);
+        cache->smallCount++;
+    } else {
+        listPushFront(&cache->head, &cache->tail, pair);
+    }
+}
+
+// Move an entry to the front of the list it is on
+static inline void queueRotate(CacheState* cache, KeyValuePair* pair) {
+    uint8_t queue = entryMeta(pair)->queue;
+    queueRemove(cache, pair);
+    queuePush(cache, pair, queue);
+}
+
+// Independent seeds for the rows of the count-min sketch
+static const uint64_t sketchSeeds[SKETCH_DEPTH] = {
+    0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL
+};
+
+static inline uint8_t* sketchCounter(const CacheState* cache, uint64_t hashValue, int row) {
+    uint64_t mixed = (hashValue ^ sketchSeeds[row]) * 0xff51afd7ed558ccdULL;
+    return &cache->sketch[(size_t)row * (cache->sketchMask + 1) + ((mixed >> 32) & cache->sketchMask)];
+}
+
+/**
+ * Count one access to a key in the frequency sketch
+ * 
+ * Counters saturate at 15. Once the sketch has counted ten accesses per
+ * counter, every counter is halved, so the estimates follow the recent
+ * popularity of keys rather than their all-time totals.
+ */
+static void sketchIncrement(CacheState* cache, uint64_t hashValue) {
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        uint8_t* counter = sketchCounter(cache, hashValue, row);
+        if (*counter < 15) {
+            (*counter)++;
+        }
+    }
+    if (++cache->sketchAdditions >= 10 * (cache->sketchMask + 1)) {
+        for (size_t i = 0; i < SKETCH_DEPTH * (cache->sketchMask + 1); i++) {
+            cache->sketch[i] >>= 1;
+        }
+        cache->sketchAdditions /= 2;
+    }
+}
+
+/**
+ * Estimate how often a key was accessed recently (the smallest of its counters)
+ */
+static int sketchEstimate(const CacheState* cache, uint64_t hashValue) {
+    int estimate = 15;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        int count = *sketchCounter(cache, hashValue, row);
+        if (count < estimate) {
+            estimate = count;
+        }
+    }
+    return estimate;
+}
+
+/**
+ * Remember the hash of a key S3-FIFO evicted from its small queue
+ * 
+ * The ghost is a direct-mapped array of hashes rather than an exact FIFO:
+ * a newer ghost simply overwrites an older one in the same slot.
+ */
+static inline void ghostAdd(CacheState* cache, uint64_t hashValue) {
+    cache->ghost[hashValue & cache->ghostMask] = hashValue | 1;  // Never 0, which marks a free slot
+}
+
+/**
+ * Check whether a key was recently evicted, forgetting it if so
+ */
+static inline bool ghostTake(CacheState* cache, uint64_t hashValue) {
+    uint64_t* slot = &cache->ghost[hashValue & cache->ghostMask];
+    if (*slot != (hashValue | 1)) {
+        return false;
+    }
+    *slot = 0;
+    return true;
+}
+
+/**
+ * Record a hit on an entry (nothing to do for unbounded tables)
+ * 
+ * Only exact LRU relinks the entry. The other policies merely bump a
+ * counter in the node (and, for W-TinyLFU, in the sketch), so a hit never
+ * touches a neighbouring node.
+ */
+static inline void cacheTouch(HashTable* ht, KeyValuePair* pair) {
+    CacheState* cache = ht->cache;
+    if (cache == NULL) {
+        return;
+    }
+    switch (cache->policy) {
+        case EVICT_LRU:
+            if (cache->head != pair) {
+                queueRotate(cache, pair);
+            }
+            break;
+        case EVICT_CLOCK:
+            entryMeta(pair)->frequency = 1;  // The reference bit
+            break;
+        case EVICT_TINYLFU:
+            sketchIncrement(cache, pair->hash);
+            // fall through
+        case EVICT_S3FIFO:
+            if (entryMeta(pair)->frequency < 3) {
+                entryMeta(pair)->frequency++;
+            }
+            break;
+    }
+}
+
+/**
+ * Record a lookup of a key that is not in the table
+ * 
+ * W-TinyLFU counts misses too: a key that keeps being asked for is
+ * admitted once it is inserted, even though it never had a hit.
+ */
+static inline void cacheMiss(HashTable* ht, uint64_t hashValue) {
+    if (ht->cache != NULL && ht->cache->policy == EVICT_TINYLFU) {
+        sketchIncrement(ht->cache, hashValue);
+    }
+}
+
+/**
+ * Recompute what an entry counts against the byte budget: its node and
+ * EntryMeta, its key copy unless the key is inline, and whatever valueSize
+ * reports
+ */
+static void cacheCharge(CacheState* cache, KeyValuePair* pair) {
+    size_t charge = sizeof(KeyValuePair) + NODE_META_BYTES;
+    if (pair->key != pair->inlineKey) {
+        charge += pair->keyLength + 1;
+    }
+    if (cache->valueSize != NULL) {
+        charge += cache->valueSize(pair->value);
+    }
+    if (charge > UINT32_MAX) {
+        charge = UINT32_MAX;
+    }
+    cache->usedBytes = cache->usedBytes - entryMeta(pair)->charge + charge;
+    entryMeta(pair)->charge = (uint32_t)charge;
+}
+
+// Whether a table in cache mode holds more than its limits allow
+static inline bool cacheOverLimits(const HashTable* ht) {
+    const CacheState* cache = ht->cache;
+    return (cache->maxEntries > 0 && ht->size > cache->maxEntries) ||
+           (cache->maxBytes > 0 && cache->usedBytes > cache->maxBytes);
+}
+
+// The number of entries W-TinyLFU keeps in its window
+static inline int tinyLfuWindowSize(const HashTable* ht) {
+    return ht->size / 100 > 0 ? ht->size / 100 : 1;
+}
+
+/**
+ * Start tracking a newly linked entry
+ * 
+ * LRU and CLOCK put it at the front of the main list. S3-FIFO puts it on
+ * probation in the small queue, unless the ghost shows it was evicted from
+ * there recently. W-TinyLFU puts it in the window; while the cache still
+ * has room, whatever overflows the window moves to the main list without
+ * having to win an admission contest.
+ */
+static void cacheAdd(HashTable* ht, KeyValuePair* pair) {
+    CacheState* cache = ht->cache;
+    if (cache == NULL) {
+        return;
+    }
+    entryMeta(pair)->charge = 0;
+    entryMeta(pair)->frequency = 0;
+    cacheCharge(cache, pair);
+
+    uint8_t queue = QUEUE_MAIN;
+    if (cache->policy == EVICT_S3FIFO) {
+        queue = ghostTake(cache, pair->hash) ? QUEUE_MAIN : QUEUE_SMALL;
+    } else if (cache->policy == EVICT_TINYLFU) {
+        sketchIncrement(cache, pair->hash);
+        queue = QUEUE_SMALL;
+    }
+    queuePush(cache, pair, queue);
+
+    if (cache->policy == EVICT_TINYLFU && cache->smallCount > tinyLfuWindowSize(ht) && !cacheOverLimits(ht)) {
+        KeyValuePair* oldest = cache->smallTail;
+        queueRemove(cache, oldest);
+        queuePush(cache, oldest, QUEUE_MAIN);
+    }
+}
+
+/**
+ * Stop tracking an entry that is being unlinked from its bucket
+ */
+static void cacheRemove(HashTable* ht, KeyValuePair* pair) {
+    if (ht->cache != NULL) {
+        queueRemove(ht->cache, pair);
+        ht->cache->usedBytes -= entryMeta(pair)->charge;
+    }
+}
+
+// Milliseconds on the monotonic clock (the default expiry clock)
+static uint64_t monotonicMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+// Microseconds on the monotonic clock (for the active cycle's time budget)
+static uint64_t monotonicMicros(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+// Whether an entry's expiry time has been reached (never, for a table without expiry)
+static inline bool isExpired(const HashTable* ht, const KeyValuePair* pair, uint64_t now) {
+    return ht->expiry != NULL && entryMeta(pair)->expireAt != 0 && entryMeta(pair)->expireAt <= now;
+}
+
+// The table's expiry clock, or 0 (before every expiry time) if it has none
+static inline uint64_t expiryNow(const HashTable* ht) {
+    return ht->expiry != NULL ? ht->expiry->clock() : 0;
+}
+
+// The wheel slot an expiry time hashes to
+static inline KeyValuePair** timerSlot(ExpiryState* expiry, uint64_t expireAt) {
+    return &expiry->wheel[(expireAt / EXPIRY_TICK_MS) & (EXPIRY_WHEEL_SLOTS - 1)];
+}
+
+/**
+ * Link an entry with an expiry time into its timer wheel slot
+ */
+static void timerAdd(ExpiryState* expiry, KeyValuePair* pair) {
+    EntryMeta* meta = entryMeta(pair);
+    KeyValuePair** slot = timerSlot(expiry, meta->expireAt);
+    meta->timerPrev = NULL;
+    meta->timerNext = *slot;
+    if (*slot != NULL) {
+        entryMeta(*slot)->timerPrev = pair;
+    }
+    *slot = pair;
+    expiry->count++;
+}
+
+/**
+ * Unlink an entry from its timer wheel slot
+ */
+static void timerRemove(ExpiryState* expiry, KeyValuePair* pair) {
+    EntryMeta* meta = entryMeta(pair);
+    if (meta->timerPrev != NULL) {
+        entryMeta(meta->timerPrev)->timerNext = meta->timerNext;
+    } else {
+        *timerSlot(expiry, meta->expireAt) = meta->timerNext;
+    }
+    if (meta->timerNext != NULL) {
+        entryMeta(meta->timerNext)->timerPrev = meta->timerPrev;
+    }
+    expiry->count--;
+}
+
+// Journal hooks (defined with the journal, see enableJournal)
+static void journalSet(HashTable* ht, const KeyValuePair* pair);
+static void journalDelete(HashTable* ht, const KeyValuePair* pair);
+static void journalExpire(HashTable* ht, const KeyValuePair* pair);
+static void freeJournal(HashTable* ht);
+
+/**
+ * Unlink a node from its bucket and from every index that tracks it
+ * 
+ * The node is not freed; the caller hands it to releasePair() once it is
+ * done with the key and value.
+ * 
+ * @param link The link that points to the node
+ */
+static KeyValuePair* unlinkPair(HashTable* ht, KeyValuePair** link) {
+    KeyValuePair* pair = *link;
+    *link = pair->next;
+    if (ht->journal != NULL) {
+        journalDelete(ht, pair);
+    }
+    cacheRemove(ht, pair);
+    if (ht->expiry != NULL && entryMeta(pair)->expireAt != 0) {
+        timerRemove(ht->expiry, pair);
+    }
+    ht->size--;
+    return pair;
+}
+
+/**
+ * Remove an entry whose time is up, handing its value to onExpire
+ * 
+ * @param link The link that points to the expired node
+ */
+static void expirePair(HashTable* ht, KeyValuePair** link) {
+    KeyValuePair* pair = unlinkPair(ht, link);
+    ExpiryState* expiry = ht->expiry;
+    if (expiry->onExpire != NULL) {
+        expiry->onExpire(pair->key, pair->keyLength, pair->value, expiry->context);
+    }
+    releasePair(ht, pair);
+}
+
+/**
+ * Expire an entry found by a lookup if its time is up (lazy expiration)
+ * 
+ * @param link The link that points to the entry
+ * @return true if the entry expired and is gone, false if it is still live
+ */
+static bool expireIfDue(HashTable* ht, KeyValuePair** link) {
+    if (ht->expiry == NULL || entryMeta(*link)->expireAt == 0 || entryMeta(*link)->expireAt > ht->expiry->clock()) {
+        return false;
+    }
+    expirePair(ht, link);
+    return true;
+}
+
+/**
+ * Find the link that points to a given node
+ * 
+ * Like findLink(), but matches the node itself rather than its key, and
+ * never fails for a node that is in the table.
+ */
+static KeyValuePair** findNodeLink(HashTable* ht, KeyValuePair* pair) {
+    KeyValuePair** link = &ht->array[indexFor(ht, pair->hash, ht->capacity)];
+    while (*link != NULL && *link != pair) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL && ht->oldArray != NULL) {
+        link = &ht->oldArray[indexFor(ht, pair->hash, ht->oldCapacity)];
+        while (*link != pair) {
+            link = &(*link)->next;
+        }
+    }
+    return link;
+}
+
+/**
+ * Pick a victim from the main list, giving used entries a second chance
+ * 
+ * The CLOCK hand: the oldest entry is the victim unless it has been used
+ * since the hand last passed it, in which case it goes back to the front
+ * with its count cleared (CLOCK, W-TinyLFU) or decremented (S3-FIFO).
+ * Every pass either finds a victim or lowers a count, so this terminates.
+ * 
+ * @return The victim, or NULL if the list holds nothing but keep
+ */
+static KeyValuePair* secondChanceVictim(CacheState* cache, KeyValuePair* keep, bool decrement) {
+    for (;;) {
+        KeyValuePair* oldest = cache->tail;
+        if (oldest == NULL || (oldest == keep && oldest == cache->head)) {
+            return NULL;
+        }
+        if (oldest != keep && entryMeta(oldest)->frequency == 0) {
+            return oldest;
+        }
+        if (oldest != keep) {
+            entryMeta(oldest)->frequency = decrement ? entryMeta(oldest)->frequency - 1 : 0;
+        }
+        queueRotate(cache, oldest);
+    }
+}
+
+/**
+ * S3-FIFO: evict from the small queue while it holds more than a tenth of
+ * the entries, promoting the ones that were used while on probation;
+ * otherwise evict from the main queue
+ */
+static KeyValuePair* s3fifoVictim(HashTable* ht, KeyValuePair* keep) {
+    CacheState* cache = ht->cache;
+    while (cache->smallTail != NULL && (cache->smallCount * 10 >= ht->size || cache->head == NULL)) {
+        KeyValuePair* oldest = cache->smallTail;
+        if (entryMeta(oldest)->frequency == 0 && oldest != keep) {
+            ghostAdd(cache, oldest->hash);
+            return oldest;
+        }
+        queueRemove(cache, oldest);
+        entryMeta(oldest)->frequency = 0;
+        queuePush(cache, oldest, QUEUE_MAIN);
+    }
+
+    KeyValuePair* victim = secondChanceVictim(cache, keep, true);
+    if (victim == NULL && cache->smallTail != NULL && cache->smallTail != keep) {
+        victim = cache->smallTail;
+        ghostAdd(cache, victim->hash);
+    }
+    return victim;
+}
+
+/**
+ * W-TinyLFU: entries leaving the window (a hundredth of the entries) must
+ * beat the main list's victim on estimated frequency to be admitted;
+ * whichever of the two loses is evicted
+ */
+static KeyValuePair* tinyLfuVictim(HashTable* ht, KeyValuePair* keep) {
+    CacheState* cache = ht->cache;
+    while (cache->smallCount > tinyLfuWindowSize(ht)) {
+        KeyValuePair* candidate = cache->smallTail;
+        KeyValuePair* victim = secondChanceVictim(cache, keep, false);
+        if (victim != NULL && candidate != keep &&
+            sketchEstimate(cache, candidate->hash) <= sketchEstimate(cache, victim->hash)) {
+            return candidate;  // Rejected: it would only push out something more popular
+        }
+        queueRemove(cache, candidate);
+        entryMeta(candidate)->frequency = 0;
+        queuePush(cache, candidate, QUEUE_MAIN);
+        if (victim != NULL) {
+            return victim;
+        }
+    }
+
+    KeyValuePair* victim = secondChanceVictim(cache, keep, false);
+    if (victim == NULL && cache->smallTail != NULL && cache->smallTail != keep) {
+        victim = cache->smallTail;
+    }
+    return victim;
+}
+
+/**
+ * Evict entries chosen by the table's policy until it is within its limits
+ * 
+ * @param ht The hash table (must be in cache mode)
+ * @param keep An entry that must not be evicted (the one just written), or NULL
+ */
+static void evictIfNeeded(HashTable* ht, KeyValuePair* keep) {
+    CacheState* cache = ht->cache;
+    while (cacheOverLimits(ht)) {
+        KeyValuePair* victim;
+        switch (cache->policy) {
+            case EVICT_CLOCK:
+                victim = secondChanceVictim(cache, keep, false);
+                break;
+            case EVICT_S3FIFO:
+                victim = s3fifoVictim(ht, keep);
+                break;
+            case EVICT_TINYLFU:
+                victim = tinyLfuVictim(ht, keep);
+                break;
+            case EVICT_LRU:
+            default:
+                victim = cache->tail != keep ? cache->tail : entryMeta(keep)->lruPrev;
+                break;
+        }
+        if (victim == NULL) {
+            return;  // A lone oversized entry stays until something replaces it
+        }
+
+        unlinkPair(ht, findNodeLink(ht, victim));
+        if (cache->onEvict != NULL) {
+            cache->onEvict(victim->key, victim->keyLength, victim->value, cache->context);
+        }
+        releasePair(ht, victim);
+    }
+}
+
+/**
+ * Free a cache state and the policy structures it owns
+ */
+static void freeCacheState(CacheState* cache) {
+    if (cache == NULL) return;
+    free(cache->ghost);
+    free(cache->sketch);
+    free(cache);
+}
+
+/**
+ * Bound the table like a cache, evicting the least recently used entries
+ * 
+ * Turns on cache mode: every entry is kept on an intrusive recency list,
+ * get() and the other lookups move an entry to the front in O(1), and an
+ * insert that takes the table over maxEntries entries or maxBytes bytes
+ * evicts from the back until it fits again. Each evicted entry is passed
+ * to onEvict, which is where the caller frees its value; delete() does not
+ * call it. setEvictionPolicy() swaps exact LRU for a cheaper or more
+ * scan-resistant policy.
+ * 
+ * The byte budget counts each entry's node and key copy plus, if valueSize
+ * is given, the size of its value. A value is sized when it is stored by
+ * insert(), upsert() or bulkLoad(); values written through a findOrInsert()
+ * slot are not re-sized until the entry's next such update.
+ * 
+ * May be called again to change the limits; entries already in the table
+ * when cache mode is first turned on join the list in bucket order, after
+ * each is copied into a node with room for its list links.
+ * 
+ * @param ht The hash table
+ * @param maxEntries The largest number of entries to keep (0 for no limit)
+ * @param maxBytes The largest number of bytes to charge (0 for no limit)
+ * @param valueSize Sizes values for the byte budget, or NULL to count only nodes and keys
+ * @param onEvict Called with each evicted entry, or NULL
+ * @param context Passed through to onEvict
+ * @return true if the limits are in force, false if allocation failed or maxEntries is negative
+ */
+bool setCacheLimits(HashTable* ht, int maxEntries, size_t maxBytes, ValueSizeFunction valueSize,
+                    EvictionCallback onEvict, void* context) {
+    if (maxEntries < 0) {
+        return false;
+    }
+
+    CacheState* cache = ht->cache;
+    if (cache == NULL) {
+        if (!enableNodeMeta(ht)) {
+            return false;
+        }
+        cache = (CacheState*)calloc(1, sizeof(CacheState));
+        if (cache == NULL) {
+            return false;
+        }
+        ht->cache = cache;
+        for (int i = 0; i < ht->capacity; i++) {
+            for (KeyValuePair* current = ht->array[i]; current != NULL; current = current->next) {
+                entryMeta(current)->frequency = 0;
+                queuePush(cache, current, QUEUE_MAIN);
+            }
+        }
+        for (int i = ht->rehashIndex; ht->oldArray != NULL && i < ht->oldCapacity; i++) {
+            for (KeyValuePair* current = ht->oldArray[i]; current != NULL; current = current->next) {
+                entryMeta(current)->frequency = 0;
+                queuePush(cache, current, QUEUE_MAIN);
+            }
+        }
+    }
+
+    cache->maxEntries = maxEntries;
+    cache->maxBytes = maxBytes;
+    cache->valueSize = valueSize;
+    cache->onEvict = onEvict;
+    cache->context = context;
+
+    // A new valueSize changes every charge
+    cache->usedBytes = 0;
+    for (KeyValuePair* current = cache->head; current != NULL; current = entryMeta(current)->lruNext) {
+        entryMeta(current)->charge = 0;
+        cacheCharge(cache, current);
+    }
+    for (KeyValuePair* current = cache->smallHead; current != NULL; current = entryMeta(current)->lruNext) {
+        entryMeta(current)->charge = 0;
+        cacheCharge(cache, current);
+    }
+
+    evictIfNeeded(ht, NULL);
+    return true;
+}
+
+/**
+ * Choose how a bounded table picks the entries it evicts
+ * 
+ * EVICT_LRU (the default) is exact but turns every hit into a list update,
+ * and a single scan over cold keys flushes the whole cache. The other
+ * policies only bump a small counter in the node on a hit:
+ * - EVICT_CLOCK approximates LRU with a reference bit and a second chance.
+ * - EVICT_S3FIFO keeps new entries in a small FIFO (a tenth of the cache)
+ *   and only promotes those that are hit again to the main FIFO, so
+ *   one-hit wonders from a scan leave quickly. The hashes of entries it
+ *   drops are remembered in a ghost array, and a key that comes back soon
+ *   goes straight to main.
+ * - EVICT_TINYLFU (W-TinyLFU) passes new entries through a window of a
+ *   hundredth of the cache; to enter the main part an entry must have a
+ *   higher estimated frequency, according to a count-min sketch of recent
+ *   lookups (hits and misses), than the entry it would displace.
+ * 
+ * The ghost array and the sketch are sized from the entry limit (or the
+ * current size) when the policy is chosen, so call this after
+ * setCacheLimits(). Switching policies keeps the entries but forgets
+ * their usage history.
+ * 
+ * @param ht The hash table (must be in cache mode)
+ * @param policy The eviction policy
+ * @return true if the policy is in force, false if the table is unbounded or allocation failed
+ */
+bool setEvictionPolicy(HashTable* ht, EvictionPolicy policy) {
+    CacheState* cache = ht->cache;
+    if (cache == NULL) {
+        return false;
+    }
+
+    size_t expected = cache->maxEntries > 0 ? (size_t)cache->maxEntries : (size_t)ht->size;
+    size_t slots = 1024;
+    while (slots < expected && slots < (size_t)MAX_POWER_OF_TWO_CAPACITY) {
+        slots *= 2;
+    }
+    uint64_t* ghost = NULL;
+    uint8_t* sketch = NULL;
+    if (policy == EVICT_S3FIFO && (ghost = (uint64_t*)calloc(slots, sizeof(uint64_t))) == NULL) {
+        return false;
+    }
+    if (policy == EVICT_TINYLFU && (sketch = (uint8_t*)calloc(SKETCH_DEPTH * slots, 1)) == NULL) {
+        return false;
+    }
+    free(cache->ghost);
+    free(cache->sketch);
+    cache->ghost = ghost;
+    cache->ghostMask = slots - 1;
+    cache->sketch = sketch;
+    cache->sketchMask = slots - 1;
+    cache->sketchAdditions = 0;
+
+    // Start over from a single list in the current order, with no history
+    while (cache->smallTail != NULL) {
+        KeyValuePair* oldest = cache->smallTail;
+        queueRemove(cache, oldest);
+        queuePush(cache, oldest, QUEUE_MAIN);
+    }
+    for (KeyValuePair* current = cache->head; current != NULL; current = entryMeta(current)->lruNext) {
+        entryMeta(current)->frequency = 0;
+    }
+    cache->policy = policy;
+    return true;
+}
+
+/**
+ * Find a key's node, adding the key first if it is missing
+ * 
+ * The body shared by insert(), findOrInsert() and upsert(): one hash
+ * (computed by the caller) and one chain walk. A new node starts with a
+ * NULL value. Either way the entry counts as used by the cache policy;
+ * the caller evicts once it has stored the value.
+ * 
+ * @param inserted Set to whether the key was added
+ * @return The key's node, or NULL if allocation failed
+ */
+static KeyValuePair* findOrInsertPair(HashTable* ht, const void* key, size_t length, uint64_t hashValue, bool* inserted) {
+    // Move part of a pending resize along
+    rehashTick(ht);
+
+    // Check if the key already exists in the table (an expired entry is
+    // reclaimed and the key added afresh)
+    KeyValuePair** link = findLink(ht, key, length, hashValue);
+    if (link != NULL && !expireIfDue(ht, link)) {
+        *inserted = false;
+        cacheTouch(ht, *link);
+        return *link;
+    }
+
+    // New keys always go into the current (newest) bucket array
+    int index = indexFor(ht, hashValue, ht->capacity);
+
+    // Key doesn't exist: create a new key-value pair
+    KeyValuePair* newPair = createPair(ht, key, length, hashValue, NULL);
+    if (newPair == NULL) {
+        *inserted = false;
+        return NULL;  // Memory allocation failed
+    }
+    
+    // Link this pair at the beginning of the bucket's list
+    newPair->next = ht->array[index];  // The current head becomes the next of our new pair
+    ht->array[index] = newPair;        // The new pair becomes the new head
+    ht->size++;                        // Increment the total size
+    cacheAdd(ht, newPair);
+
+    // Keep the chains short by growing once the table gets too full
+    growIfNeeded(ht);
+
+    *inserted = true;
+    return newPair;
+}
+
+/**
+ * Store a value in a node returned by findOrInsertPair(), then enforce
+ * the cache limits (if any) around it
+ */
+static void storeValue(HashTable* ht, KeyValuePair* pair, void* value) {
+    pair->value = value;
+    if (ht->journal != NULL) {
+        journalSet(ht, pair);  // Logged before any eviction it causes
+    }
+    if (ht->cache != NULL) {
+        cacheCharge(ht->cache, pair);
+        evictIfNeeded(ht, pair);
+    }
+}
+
+/**
+ * Insert a key whose hash the caller has already computed
+ * 
+ * The body of insertBytes(), shared with front-ends that hash a key
+ * once to route it and must not hash it again.
+ */
+static bool insertHashed(HashTable* ht, const void* key, size_t length, uint64_t hashValue, void* value) {
+    bool inserted;
+    KeyValuePair* pair = findOrInsertPair(ht, key, length, hashValue, &inserted);
+    if (pair == NULL) {
+        return false;
+    }
+    storeValue(ht, pair, value);
+    return true;
+}
+
+/**
+ * Insert a key-value pair with a key of known length
+ * 
+ * The length-aware form of insert(): the key does not need to be
+ * NUL-terminated and may contain zero bytes, so it can point straight into
+ * a receive buffer. The table stores its own (NUL-terminated) copy.
+ * 
+ * @param ht The hash table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool insertBytes(HashTable* ht, const void* key, size_t length, void* value) {
+    // Hash the key once; the result is reused for the lookup and stored in the node
+    return insertHashed(ht, key, length, ht->hashFunction(key, length), value);
+}
+
+/**
+ * Insert a key-value pair into the hash table
+ * 
+ * If the key already exists, its value is updated.
+ * Otherwise, a new key-value pair is created.
+ * 
+ * @param ht The hash table
+ * @param key The string key
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool insert(HashTable* ht, const char* key, void* value) {
+    return insertBytes(ht, key, strlen(key), value);
+}
+
+/**
+ * Find a key's value slot, inserting the key if it is missing
+ * 
+ * For read-modify-write patterns such as counters: the key is hashed once
+ * and its chain walked once, whether or not it was present, and the caller
+ * then reads or writes the value in place. A newly inserted key's value is
+ * NULL.
+ * 
+ * Nodes never move, so the slot stays valid across later inserts and
+ * resizes, until the key is deleted or evicted or the table is freed.
+ * The one exception: the first setCacheLimits() or expiry call on a table
+ * moves every node once, to make room for its bookkeeping.
+ * 
+ * A journal (see enableJournal) could not see writes made through the
+ * slot, so a table with one refuses this call; use upsert() instead.
+ * 
+ * @param ht The hash table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param inserted Set to true if the key was added, false if it already existed
+ * @return The address of the key's value, or NULL if allocation failed or the table has a journal
+ */
+void** findOrInsertBytes(HashTable* ht, const void* key, size_t length, bool* inserted) {
+    if (ht->journal != NULL) {
+        return NULL;
+    }
+    KeyValuePair* pair = findOrInsertPair(ht, key, length, ht->hashFunction(key, length), inserted);
+    if (pair == NULL) {
+        return NULL;
+    }
+    if (*inserted && ht->cache != NULL) {
+        evictIfNeeded(ht, pair);
+    }
+    return &pair->value;
+}
+
+/**
+ * Find a key's value slot, inserting the key if it is missing
+ * 
+ * @param ht The hash table
+ * @param key The string key
+ * @param inserted Set to true if the key was added, false if it already existed
+ * @return The address of the key's value, or NULL if allocation failed or the table has a journal
+ */
+void** findOrInsert(HashTable* ht, const char* key, bool* inserted) {
+    return findOrInsertBytes(ht, key, strlen(key), inserted);
+}
+
+/**
+ * Insert a key or update its value through a callback
+ * 
+ * update receives the current value (NULL for a new key), whether the key
+ * already existed, and context, and returns the value to store. It must
+ * not modify the table.
+ * 
+ * @param ht The hash table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param update Computes the new value
+ * @param context Passed through to update
+ * @return true if the value was stored, false if allocation failed
+ */
+bool upsertBytes(HashTable* ht, const void* key, size_t length, UpsertFunction update, void* context) {
+    bool inserted;
+    KeyValuePair* pair = findOrInsertPair(ht, key, length, ht->hashFunction(key, length), &inserted);
+    if (pair == NULL) {
+        return false;
+    }
+    storeValue(ht, pair, update(pair->value, !inserted, context));
+    return true;
+}
+
+/**
+ * Insert a key or update its value through a callback
+ * 
+ * @param ht The hash table
+ * @param key The string key
+ * @param update Computes the new value from the current one
+ * @param context Passed through to update
+ * @return true if the value was stored, false if allocation failed
+ */
+bool upsert(HashTable* ht, const char* key, UpsertFunction update, void* context) {
+    return upsertBytes(ht, key, strlen(key), update, context);
+}
+
+/**
+ * Load many key-value pairs at once
+ * 
+ * The fast path for filling a table from a snapshot. Compared with calling
+ * insert() in a loop it:
+ * - sizes the bucket array once for the final element count, so no
+ *   intermediate doubling ever rehashes the entries loaded so far;
+ * - on a table with a node pool (see enableNodePool), reserves room for
+ *   every node and long key copy of the batch up front, so they are carved
+ *   from one block. The pool is not switched on here: it never reclaims
+ *   the space of deleted keys, which only the caller can decide to accept;
+ * - hashes the entries a group at a time and prefetches their buckets;
+ * - with assumeUnique, skips the duplicate-check chain walk entirely.
+ * 
+ * assumeUnique is a promise by the caller: the keys must differ from each
+ * other and from every key already in the table. If it is broken the table
+ * ends up holding duplicates, and which value get() returns is unspecified.
+ * Without it, later entries overwrite earlier ones as with insert().
+ * 
+ * @param ht The hash table
+ * @param entries The key-value pairs; keys need not be NUL-terminated
+ * @param n The number of entries
+ * @param assumeUnique Whether to skip checking for keys that are already present
+ * @return true if every entry was loaded, false if allocation failed part way
+ */
+bool bulkLoad(HashTable* ht, const HashTableEntry* entries, int n, bool assumeUnique) {
+    if (n <= 0) {
+        return n == 0;
+    }
+    if ((long)ht->size + n > INT_MAX || !reserve(ht, ht->size + n)) {
+        return false;
+    }
+    // Entries go straight into the final bucket array
+    finishRehash(ht);
+
+    if (ht->pool != NULL) {
+        size_t keyBytes = 0;
+        for (int i = 0; i < n; i++) {
+            size_t bytes = entries[i].keyLength + 1;
+            if (entries[i].keyLength >= INLINE_KEY_CAPACITY && bytes <= KEY_ARENA_CHUNK_BYTES) {
+                keyBytes += bytes;  // Longer keys get a chunk of their own anyway
+            }
+        }
+        if (!poolReserve(ht->pool, n, keyBytes)) {
+            return false;
+        }
+    }
+
+    uint64_t hashes[BATCH_GROUP_SIZE];
+    for (int base = 0; base < n; base += BATCH_GROUP_SIZE) {
+        int count = n - base < BATCH_GROUP_SIZE ? n - base : BATCH_GROUP_SIZE;
+
+        // Hash a group ahead and prefetch its buckets, as getBatch() does
+        for (int i = 0; i < count; i++) {
+            hashes[i] = ht->hashFunction(entries[base + i].key, entries[base + i].keyLength);
+            __builtin_prefetch(&ht->array[indexFor(ht, hashes[i], ht->capacity)]);
+        }
+
+        for (int i = 0; i < count; i++) {
+            const HashTableEntry* entry = &entries[base + i];
+            if (!assumeUnique) {
+                KeyValuePair** link = findLink(ht, entry->key, entry->keyLength, hashes[i]);
+                if (link != NULL && !expireIfDue(ht, link)) {
+                    cacheTouch(ht, *link);
+                    storeValue(ht, *link, entry->value);
+                    continue;
+                }
+            }
+
+            KeyValuePair* newPair = createPair(ht, entry->key, entry->keyLength, hashes[i], entry->value);
+            if (newPair == NULL) {
+                return false;
+            }
+            int index = indexFor(ht, hashes[i], ht->capacity);
+            newPair->next = ht->array[index];
+            ht->array[index] = newPair;
+            ht->size++;
+            if (ht->journal != NULL) {
+                journalSet(ht, newPair);
+            }
+            if (ht->cache != NULL) {
+                cacheAdd(ht, newPair);
+                evictIfNeeded(ht, newPair);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Look up a key whose hash the caller has already computed
+ */
+static void* getHashed(HashTable* ht, const void* key, size_t length, uint64_t hashValue) {
+    // Move part of a pending resize along
+    rehashTick(ht);
+    
+    // Traverse the linked list in the key's bucket to find the key
+    KeyValuePair** link = findLink(ht, key, length, hashValue);
+    if (link != NULL && !expireIfDue(ht, link)) {
+        // Key found: return its value
+        cacheTouch(ht, *link);
+        return (*link)->value;
+    }
+    
+    // Key not found
+    cacheMiss(ht, hashValue);
+    return NULL;
+}
+
+/**
+ * Retrieve a value by a key of known length
+ * 
+ * The length-aware form of get(). Keys match only if their lengths are
+ * equal, so the key bytes are compared with a single memcmp.
+ * 
+ * @param ht The hash table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return The value associated with the key, or NULL if key not found
+ */
+void* getBytes(HashTable* ht, const void* key, size_t length) {
+    return getHashed(ht, key, length, ht->hashFunction(key, length));
+}
+
+/**
+ * Retrieve a value from the hash table by its key
+ * 
+ * @param ht The hash table
+ * @param key The key to look up
+ * @return The value associated with the key, or NULL if key not found
+ */
+void* get(HashTable* ht, const char* key) {
+    return getBytes(ht, key, strlen(key));
+}
+
+/**
+ * Look up many keys at once, overlapping their cache misses
+ * 
+ * A get() on a table larger than the cache waits for two misses in a row:
+ * the bucket slot, then the first node of the chain. getBatch() works on
+ * groups of BATCH_GROUP_SIZE keys and splits each lookup into stages:
+ * hash every key and prefetch its bucket slot, then load every slot and
+ * prefetch its first node, and only then walk the chains. By the time a
+ * stage needs a cache line, the prefetch issued for it a whole group
+ * earlier has usually arrived, so the misses of a group are paid for
+ * roughly once instead of once per key.
+ * 
+ * While an incremental rehash is in progress a key may live in either
+ * bucket array, and while entries have expiry times a lookup may remove
+ * the very nodes a group has loaded, so in both cases the batch falls
+ * back to one get() per key.
+ * 
+ * @param ht The hash table
+ * @param keys The keys to look up
+ * @param n The number of keys
+ * @param values Filled in with each key's value, or NULL where the key is not found
+ * @return The number of keys found
+ */
+int getBatch(HashTable* ht, const char* const keys[], int n, void* values[]) {
+    int found = 0;
+
+    if (ht->oldArray != NULL || (ht->expiry != NULL && ht->expiry->count > 0)) {
+        for (int i = 0; i < n; i++) {
+            values[i] = get(ht, keys[i]);
+            found += values[i] != NULL;
+        }
+        return found;
+    }
+
+    uint64_t hashes[BATCH_GROUP_SIZE];
+    size_t lengths[BATCH_GROUP_SIZE];
+    KeyValuePair** slots[BATCH_GROUP_SIZE];
+    KeyValuePair* heads[BATCH_GROUP_SIZE];
+
+    for (int base = 0; base < n; base += BATCH_GROUP_SIZE) {
+        int count = n - base < BATCH_GROUP_SIZE ? n - base : BATCH_GROUP_SIZE;
+
+        // Stage 1: hash each key and start fetching its bucket slot
+        for (int i = 0; i < count; i++) {
+            lengths[i] = strlen(keys[base + i]);
+            hashes[i] = ht->hashFunction(keys[base + i], lengths[i]);
+            slots[i] = &ht->array[indexFor(ht, hashes[i], ht->capacity)];
+            __builtin_prefetch(slots[i]);
+        }
+
+        // Stage 2: read the slots and start fetching the first nodes
+        for (int i = 0; i < count; i++) {
+            heads[i] = *slots[i];
+            if (heads[i] != NULL) {
+                __builtin_prefetch(heads[i]);
+            }
+        }
+
+        // Stage 3: walk the chains, whose first nodes should now be in cache
+        for (int i = 0; i < count; i++) {
+            KeyValuePair* current = heads[i];
+            while (current != NULL && !pairMatches(current, keys[base + i], lengths[i], hashes[i])) {
+                current = current->next;
+            }
+            if (current != NULL) {
+                cacheTouch(ht, current);
+                values[base + i] = current->value;
+                found++;
+            } else {
+                cacheMiss(ht, hashes[i]);
+                values[base + i] = NULL;
+            }
+        }
+    }
+    return found;
+}
+
+/**
+ * Delete a key whose hash the caller has already computed
+ */
+static bool deleteHashed(HashTable* ht, const void* key, size_t length, uint64_t hashValue) {
+    // Move part of a pending resize along
+    rehashTick(ht);
+
+    // Find the link (bucket head or previous node) that points to the key
+    KeyValuePair** link = findLink(ht, key, length, hashValue);
+    if (link == NULL) {
+        return false;  // Key not found
+    }
+
+    // An entry whose time is up is already gone as far as callers can
+    // tell: reclaim it as an expiry rather than a delete
+    if (expireIfDue(ht, link)) {
+        shrinkIfNeeded(ht);
+        return false;
+    }
+
+    // Key found: remove this node from the linked list and every index
+    KeyValuePair* current = unlinkPair(ht, link);
+
+    // Free the memory used by this key-value pair
+    releasePair(ht, current);
+
+    // Give memory back if the table has become mostly empty
+    shrinkIfNeeded(ht);
+
+    return true;  // Successfully deleted
+}
+
+/**
+ * Delete a key-value pair by a key of known length
+ * 
+ * The length-aware form of delete().
+ * 
+ * @param ht The hash table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return true if key was found and deleted, false if key not found
+ */
+bool deleteBytes(HashTable* ht, const void* key, size_t length) {
+    return deleteHashed(ht, key, length, ht->hashFunction(key, length));
+}
+
+/**
+ * Delete a key-value pair from the hash table
+ * 
+ * @param ht The hash table
+ * @param key The key to delete
+ * @return true if key was found and deleted, false if key not found
+ */
+bool delete(HashTable* ht, const char* key) {
+    return deleteBytes(ht, key, strlen(key));
+}
+
+/**
+ * Give a table its timer wheel, if it does not have one yet
+ * 
+ * @return The table's expiry state, or NULL if allocation failed
+ */
+static ExpiryState* ensureExpiry(HashTable* ht) {
+    if (ht->expiry == NULL) {
+        if (!enableNodeMeta(ht)) {
+            return NULL;
+        }
+        ExpiryState* expiry = (ExpiryState*)calloc(1, sizeof(ExpiryState));
+        if (expiry == NULL) {
+            return NULL;
+        }
+        expiry->clock = monotonicMs;
+        expiry->nextTick = expiry->clock() / EXPIRY_TICK_MS;
+        ht->expiry = expiry;
+    }
+    return ht->expiry;
+}
+
+/**
+ * Give a node a new expiry time (0: never), moving it between wheel slots
+ */
+static void setPairExpiry(HashTable* ht, KeyValuePair* pair, uint64_t expireAt) {
+    bool changed = expireAt != 0 || entryMeta(pair)->expireAt != 0;
+    if (entryMeta(pair)->expireAt != 0) {
+        timerRemove(ht->expiry, pair);
+    }
+    entryMeta(pair)->expireAt = expireAt;
+    if (expireAt != 0) {
+        timerAdd(ht->expiry, pair);
+    }
+    if (changed && ht->journal != NULL) {
+        journalExpire(ht, pair);
+    }
+}
+
+/**
+ * Register a callback for entries that expire
+ * 
+ * onExpire is called with the key and value of every entry removed because
+ * its time was up, whether a lookup ran into it or activeExpireCycle()
+ * found it, so the caller can free the value. It must not modify the table.
+ * 
+ * @param ht The hash table
+ * @param onExpire Called with each expired entry (NULL for none)
+ * @param context Passed through to onExpire
+ * @return true on success, false if allocation failed
+ */
+bool setExpiryCallback(HashTable* ht, EvictionCallback onExpire, void* context) {
+    ExpiryState* expiry = ensureExpiry(ht);
+    if (expiry == NULL) {
+        return false;
+    }
+    expiry->onExpire = onExpire;
+    expiry->context = context;
+    return true;
+}
+
+/**
+ * Replace the clock that expiry times are measured against
+ * 
+ * The default is CLOCK_MONOTONIC in milliseconds. A custom clock (a cached
+ * "now" of an event loop, or a fake clock in tests) must also count
+ * milliseconds and must never go backwards. It can only be changed while
+ * no entry has an expiry time.
+ * 
+ * @param ht The hash table
+ * @param clock The new time source
+ * @return true on success, false if entries already expire or allocation failed
+ */
+bool setExpiryClock(HashTable* ht, ClockFunction clock) {
+    ExpiryState* expiry = ensureExpiry(ht);
+    if (expiry == NULL || expiry->count > 0) {
+        return false;
+    }
+    expiry->clock = clock;
+    expiry->nextTick = clock() / EXPIRY_TICK_MS;
+    return true;
+}
+
+/**
+ * Set or clear the time to live of a key of known length
+ * 
+ * The length-aware form of setExpire().
+ * 
+ * @param ht The hash table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param ttlMs Milliseconds from now until the entry expires (0: never)
+ * @return true if the key was found, false if it is missing or has already expired
+ */
+bool setExpireBytes(HashTable* ht, const void* key, size_t length, uint64_t ttlMs) {
+    ExpiryState* expiry = ensureExpiry(ht);
+    if (expiry == NULL) {
+        return false;
+    }
+
+    rehashTick(ht);
+    KeyValuePair** link = findLink(ht, key, length, ht->hashFunction(key, length));
+    if (link == NULL || expireIfDue(ht, link)) {
+        return false;
+    }
+    setPairExpiry(ht, *link, ttlMs != 0 ? expiry->clock() + ttlMs : 0);
+    return true;
+}
+
+/**
+ * Set or clear the time to live of a key
+ * 
+ * Once its time is up an entry is gone: get() no longer finds it, delete()
+ * reports it missing, the iterator and scans skip it, and insert() adds
+ * the key afresh. Expired entries are reclaimed lazily by the lookups that
+ * run into them, and actively by activeExpireCycle(). Overwriting a live
+ * entry with insert() keeps its expiry time; use insertWithTtl() to replace
+ * both.
+ * 
+ * @param ht The hash table
+ * @param key The key
+ * @param ttlMs Milliseconds from now until the entry expires (0: never)
+ * @return true if the key was found, false if it is missing or has already expired
+ */
+bool setExpire(HashTable* ht, const char* key, uint64_t ttlMs) {
+    return setExpireBytes(ht, key, strlen(key), ttlMs);
+}
+
+/**
+ * Insert or update a key of known length together with its time to live
+ * 
+ * The length-aware form of insertWithTtl().
+ * 
+ * @param ht The hash table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param value The value
+ * @param ttlMs Milliseconds from now until the entry expires (0: never)
+ * @return true on success, false if allocation failed
+ */
+bool insertWithTtlBytes(HashTable* ht, const void* key, size_t length, void* value, uint64_t ttlMs) {
+    ExpiryState* expiry = ensureExpiry(ht);
+    if (expiry == NULL) {
+        return false;
+    }
+
+    bool inserted;
+    KeyValuePair* pair = findOrInsertPair(ht, key, length, ht->hashFunction(key, length), &inserted);
+    if (pair == NULL) {
+        return false;
+    }
+    // Value first, so that a journal logs the key before its expiry time
+    storeValue(ht, pair, value);
+    setPairExpiry(ht, pair, ttlMs != 0 ? expiry->clock() + ttlMs : 0);
+    return true;
+}
+
+/**
+ * Insert or update a key together with its time to live
+ * 
+ * Like insert(), but the entry also expires ttlMs milliseconds from now,
+ * replacing any expiry time it had (0 makes it permanent).
+ * 
+ * @param ht The hash table
+ * @param key The key
+ * @param value The value
+ * @param ttlMs Milliseconds from now until the entry expires (0: never)
+ * @return true on success, false if allocation failed
+ */
+bool insertWithTtl(HashTable* ht, const char* key, void* value, uint64_t ttlMs) {
+    return insertWithTtlBytes(ht, key, strlen(key), value, ttlMs);
+}
+
+/**
+ * Reclaim expired entries for a bounded slice of time
+ * 
+ * Lazy expiration only reclaims the entries that lookups run into; keys
+ * that are never touched again would otherwise hold their memory forever.
+ * Meant to be called periodically (from a timer or an idle loop), this
+ * walks the timer wheel tick by tick from where the previous call stopped
+ * up to the present, removing every entry whose time is up. Only entries
+ * that have an expiry time are looked at, never the buckets themselves.
+ * Entries due in a later turn of the wheel share a slot with those due
+ * now and are skipped. The clock is checked every 16 expirations, and once
+ * the budget is spent the walk stops and the next call resumes it.
+ * 
+ * @param ht The hash table
+ * @param budgetMicros The time slice in microseconds (0 for EXPIRY_DEFAULT_BUDGET_US)
+ * @return The number of entries expired
+ */
+int activeExpireCycle(HashTable* ht, uint64_t budgetMicros) {
+    ExpiryState* expiry = ht->expiry;
+    if (expiry == NULL) {
+        return 0;
+    }
+    if (budgetMicros == 0) {
+        budgetMicros = EXPIRY_DEFAULT_BUDGET_US;
+    }
+
+    uint64_t now = expiry->clock();
+    uint64_t nowTick = now / EXPIRY_TICK_MS;
+    if (expiry->count == 0) {
+        expiry->nextTick = nowTick;  // Nothing can be due in the ticks in between
+        return 0;
+    }
+    // More than a full turn behind: one turn visits every slot once
+    if (nowTick - expiry->nextTick >= EXPIRY_WHEEL_SLOTS) {
+        expiry->nextTick = nowTick - EXPIRY_WHEEL_SLOTS + 1;
+    }
+
+    uint64_t start = monotonicMicros();
+    int expired = 0;
+    for (;;) {
+        KeyValuePair** link = &expiry->wheel[expiry->nextTick & (EXPIRY_WHEEL_SLOTS - 1)];
+        while (*link != NULL) {
+            KeyValuePair* pair = *link;
+            if (entryMeta(pair)->expireAt > now) {
+                link = &entryMeta(pair)->timerNext;  // Due in a later turn (or later this tick)
+                continue;
+            }
+            // Unlinking the entry also takes it off this slot, so *link moves on
+            expirePair(ht, findNodeLink(ht, pair));
+            if (++expired % 16 == 0 && monotonicMicros() - start >= budgetMicros) {
+                shrinkIfNeeded(ht);
+                return expired;
+            }
+        }
+        // The current tick stays open: entries may still be added to it
+        if (expiry->nextTick >= nowTick) {
+            break;
+        }
+        expiry->nextTick++;
+    }
+
+    shrinkIfNeeded(ht);
+    return expired;
+}
+
+/**
+ * Free all memory used by the hash table
+ * 
+ * @param ht The hash table to free
+ */
+void freeHashTable(HashTable* ht) {
+    if (ht == NULL) return;
+
+    // Write out the last group of logged changes
+    freeJournal(ht);
+
+    // Pooled nodes and keys go away with their chunks: no need to walk the chains
+    if (ht->pool != NULL) {
+        poolFreeChunks(ht->pool->nodeChunks);
+        poolFreeChunks(ht->pool->keyChunks);
+        free(ht->pool);
+        freeCacheState(ht->cache);
+        free(ht->expiry);
+        free(ht->oldArray);
+        free(ht->array);
+        free(ht);
+        return;
+    }
+
+    // Free all KeyValuePair nodes in all buckets
+    for (int i = 0; i < ht->capacity; i++) {
+        KeyValuePair* current = ht->array[i];
+        while (current != NULL) {
+            KeyValuePair* next = current->next;
+            releasePair(ht, current);  // Free the key string and the KeyValuePair structure
+            current = next;
+        }
+    }
+    
+    // A table that is still rehashing has nodes in the old array as well
+    if (ht->oldArray != NULL) {
+        for (int i = 0; i < ht->oldCapacity; i++) {
+            KeyValuePair* current = ht->oldArray[i];
+            while (current != NULL) {
+                KeyValuePair* next = current->next;
+                releasePair(ht, current);
+                current = next;
+            }
+        }
+        free(ht->oldArray);
+    }
+    
+    // Free the array of buckets and the hash table structure itself
+    freeCacheState(ht->cache);
+    free(ht->expiry);
+    free(ht->array);
+    free(ht);
+}
+
+/**
+ * Print the contents of the hash table (for debugging)
+ * 
+ * @param ht The hash table to print
+ */
+void printHashTable(HashTable* ht) {
+    printf("Hash Table (size: %d, capacity: %d)\n", ht->size, ht->capacity);
+    
+    for (int i = 0; i < ht->capacity; i++) {
+        KeyValuePair* current = ht->array[i];
+        if (current != NULL) {
+            printf("  Bucket %d:", i);
+            while (current != NULL) {
+                printf(" [%.*s]->", (int)current->keyLength, current->key);
+                current = current->next;
+            }
+            printf("NULL\n");
+        }
+    }
+
+    // Buckets that an incremental rehash has not migrated yet
+    if (ht->oldArray != NULL) {
+        for (int i = ht->rehashIndex; i < ht->oldCapacity; i++) {
+            KeyValuePair* current = ht->oldArray[i];
+            if (current != NULL) {
+                printf("  Old bucket %d:", i);
+                while (current != NULL) {
+                    printf(" [%.*s]->", (int)current->keyLength, current->key);
+                    current = current->next;
+                }
+                printf("NULL\n");
+            }
+        }
+    }
+}
+
+/**
+ * Collect chain-length statistics (for tuning and benchmarks)
+ * 
+ * @param ht The hash table
+ * @param stats Filled in with the size, capacity and chain lengths
+ */
+void getHashTableStats(HashTable* ht, HashTableStats* stats) {
+    // Report on a single bucket array
+    finishRehash(ht);
+
+    stats->size = ht->size;
+    stats->capacity = ht->capacity;
+    stats->usedBuckets = 0;
+    stats->maxChain = 0;
+
+    for (int i = 0; i < ht->capacity; i++) {
+        int length = 0;
+        for (KeyValuePair* current = ht->array[i]; current != NULL; current = current->next) {
+            length++;
+        }
+        if (length > 0) {
+            stats->usedBuckets++;
+        }
+        if (length > stats->maxChain) {
+            stats->maxChain = length;
+        }
+    }
+
+    stats->meanChain = stats->usedBuckets > 0 ? (double)ht->size / stats->usedBuckets : 0.0;
+}
+
+/**
+ * Start iterating over every entry of the table
+ * 
+ * The iterator lives wherever the caller puts it (usually the stack) and
+ * allocates nothing. The table must not be modified until the iteration
+ * is over; to enumerate a table that writers keep changing, put it in
+ * mask mode and use scanHashTable() instead.
+ * 
+ * @param it The iterator to initialize
+ * @param ht The hash table
+ */
+void initHashTableIterator(HashTableIterator* it, HashTable* ht) {
+    it->ht = ht;
+    it->bucket = 0;
+    it->inOldArray = false;
+    it->current = NULL;
+}
+
+/**
+ * Advance an iterator to the next node that has not expired by now
+ * 
+ * @return The node, or NULL once every node has been seen
+ */
+static KeyValuePair* nextLivePair(HashTableIterator* it, uint64_t now) {
+    HashTable* ht = it->ht;
+    KeyValuePair* pair;
+    do {
+        while (it->current == NULL) {
+            KeyValuePair** array = it->inOldArray ? ht->oldArray : ht->array;
+            int capacity = it->inOldArray ? ht->oldCapacity : ht->capacity;
+            if (it->bucket < capacity) {
+                it->current = array[it->bucket++];
+            } else if (!it->inOldArray && ht->oldArray != NULL) {
+                it->inOldArray = true;
+                it->bucket = ht->rehashIndex;  // Buckets below it were migrated and are empty
+            } else {
+                return NULL;
+            }
+        }
+        pair = it->current;
+        it->current = pair->next;
+    } while (isExpired(ht, pair, now));
+    return pair;
+}
+
+/**
+ * Advance an iterator to the next entry
+ * 
+ * Entries come in bucket order; while an incremental rehash is in progress
+ * the buckets that have not been migrated yet follow those of the new array.
+ * Expired entries that have not been reclaimed yet are skipped.
+ * 
+ * @param it The iterator
+ * @param key Set to the entry's key (NUL-terminated, owned by the table)
+ * @param length Set to the length of the key
+ * @param value Set to the entry's value
+ * @return true if an entry was produced, false once every entry has been seen
+ */
+bool nextHashTableEntry(HashTableIterator* it, const char** key, size_t* length, void** value) {
+    KeyValuePair* pair = nextLivePair(it, expiryNow(it->ht));
+    if (pair == NULL) {
+        return false;
+    }
+    *key = pair->key;
+    *length = pair->keyLength;
+    *value = pair->value;
+    return true;
+}
+
+/**
+ * Call fn on every live entry of one bucket
+ */
+static int scanBucket(const HashTable* ht, KeyValuePair* current, uint64_t now, ScanFunction fn, void* context) {
+    int visited = 0;
+    for (; current != NULL; current = current->next) {
+        if (isExpired(ht, current, now)) {
+            continue;
+        }
+        fn(current->key, current->keyLength, current->value, context);
+        visited++;
+    }
+    return visited;
+}
+
+/**
+ * Advance a scan cursor in reverse-bit order for a power-of-two mask
+ * 
+ * Incrementing the bit-reversed cursor visits the bucket indices high bit
+ * first, so every bucket of a smaller table is finished before its "child"
+ * buckets of a larger one are started, and vice versa.
+ */
+static uint64_t scanAdvance(uint64_t cursor, uint64_t mask) {
+    cursor |= ~mask;  // Make the increment carry straight past the unused bits
+    cursor = reverseBits(cursor);
+    cursor++;
+    return reverseBits(cursor);
+}
+
+/**
+ * Enumerate the table a few buckets at a time (Redis SCAN)
+ * 
+ * Start with cursor 0, pass each returned cursor to the next call, and stop
+ * when 0 is returned. Each call visits whole buckets until it has reported
+ * at least count entries, so a caller can stream the table in bounded
+ * chunks, letting writers in between (each call, not the whole scan, must
+ * exclude writers).
+ * 
+ * The cursor survives any number of resizes between calls: it is advanced
+ * by incrementing its reversed bits, which moves through bucket indices so
+ * that every entry present for the whole scan is reported at least once.
+ * Entries may be reported twice if the table shrinks, and entries added or
+ * deleted during the scan may or may not appear. While an incremental
+ * rehash is in progress, each bucket of the smaller array is reported
+ * together with every bucket of the larger array that it expands to.
+ * 
+ * That only works with power-of-two capacities, so the table must be in
+ * mask mode: call setIndexMode(ht, INDEX_MASK) before scanning a table
+ * created in another mode. For any other table nothing is reported and
+ * SCAN_FAILED is returned.
+ * 
+ * Expired entries that have not been reclaimed yet are skipped. fn must
+ * not modify the table.
+ * 
+ * @param ht The hash table
+ * @param cursor 0 to start, afterwards the value returned by the previous call
+ * @param count The number of entries to report before returning (at least one bucket is always visited)
+ * @param fn Called with each entry
+ * @param context Passed through to fn
+ * @return The cursor for the next call, 0 if the scan is complete, or SCAN_FAILED
+ */
+uint64_t scanHashTable(HashTable* ht, uint64_t cursor, int count, ScanFunction fn, void* context) {
+    int visited = 0;
+    uint64_t now = expiryNow(ht);
+
+    // A plain bucket index would skip or repeat buckets once the table grows
+    if (ht->indexMode != INDEX_MASK) {
+        return SCAN_FAILED;
+    }
+
+    do {
+        if (ht->oldArray == NULL) {
+            uint64_t mask = (uint64_t)ht->capacity - 1;
+            visited += scanBucket(ht, ht->array[cursor & mask], now, fn, context);
+            cursor = scanAdvance(cursor, mask);
+        } else {
+            // Visit the small array's bucket, then every bucket of the large array it expands to
+            KeyValuePair** small = ht->array;
+            KeyValuePair** large = ht->oldArray;
+            uint64_t smallMask = (uint64_t)ht->capacity - 1;
+            uint64_t largeMask = (uint64_t)ht->oldCapacity - 1;
+            if (ht->oldCapacity < ht->capacity) {
+                small = ht->oldArray;
+                large = ht->array;
+                smallMask = (uint64_t)ht->oldCapacity - 1;
+                largeMask = (uint64_t)ht->capacity - 1;
+            }
+
+            visited += scanBucket(ht, small[cursor & smallMask], now, fn, context);
+            do {
+                visited += scanBucket(ht, large[cursor & largeMask], now, fn, context);
+                // Increment the bits the large mask has beyond the small one
+                cursor = scanAdvance(cursor, largeMask);
+            } while (cursor & (smallMask ^ largeMask));
+        }
+    } while (cursor != 0 && visited < count);
+
+    return cursor;
+}
+
+/**
+ * Open-Addressing Engine: SwissTable
+ * 
+ * An alternative to HashTable with the same insert/get/delete semantics.
+ * Instead of a chain of separately allocated nodes per bucket, entries live
+ * directly in one flat array of slots. A parallel array holds one control
+ * byte per slot: EMPTY, DELETED (a tombstone), or - for a full slot - the
+ * low 7 bits of the key's hash. A lookup loads 16 control bytes at once,
+ * compares them all against the 7-bit tag with a single SSE2 instruction,
+ * and only looks at the slots whose tag matched. Most lookups touch one
+ * control group and one slot, and never follow a pointer to another node.
+ */
+#ifdef __SSE2__
+#include <emmintrin.h>  // For the SSE2 compare-and-movemask intrinsics
+#endif
+
+#define SWISS_GROUP_WIDTH 16            // Control bytes probed per step
+#define SWISS_EMPTY ((int8_t)-128)      // 0b10000000: never used since the last rebuild
+#define SWISS_DELETED ((int8_t)-2)      // 0b11111110: tombstone left behind by a delete
+
+/**
+ * SwissSlot Structure
+ * 
+ * One entry of a SwissTable. Only meaningful when its control byte is full.
+ */
+typedef struct SwissSlot {
+    char* key;          // A copy of the key
+    void* value;        // A pointer to the value
+    uint64_t hash;      // The full hash of the key
+    size_t keyLength;   // The length of the key
+} SwissSlot;
+
+/**
+ * SwissTable Structure
+ */
+typedef struct SwissTable {
+    int8_t* control;    // One control byte per slot (EMPTY, DELETED or a 7-bit hash tag)
+    SwissSlot* slots;   // The entries
+    size_t capacity;    // The number of slots: a power of two and a multiple of SWISS_GROUP_WIDTH
+    size_t size;        // The number of entries stored
+    size_t growthLeft;  // EMPTY slots that may still be filled before a rebuild (keeps load <= 7/8)
+} SwissTable;
+
+/**
+ * Find the control bytes of a group that equal a given byte
+ * 
+ * @param group The first of SWISS_GROUP_WIDTH control bytes
+ * @param tag The byte to look for
+ * @return A bit mask with bit i set when group[i] == tag
+ */
+static inline uint32_t swissMatch(const int8_t* group, int8_t tag) {
+#ifdef __SSE2__
+    __m128i control = _mm_load_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(tag)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Find the control bytes of a group that are EMPTY or DELETED
+ * 
+ * Both special values have the sign bit set and full slots never do,
+ * so the movemask of the raw bytes is exactly the set of free slots.
+ */
+static inline uint32_t swissMatchFree(const int8_t* group) {
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i*)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+// The 7-bit tag stored in the control byte, and the group a probe starts at
+static inline int8_t swissTag(uint64_t hashValue) {
+    return (int8_t)(hashValue & 0x7f);
+}
+
+static inline size_t swissFirstGroup(const SwissTable* st, uint64_t hashValue) {
+    return (size_t)(hashValue >> 7) & (st->capacity / SWISS_GROUP_WIDTH - 1);
+}
+
+/**
+ * Allocate the control bytes and slots of a SwissTable
+ * 
+ * @param st The table whose arrays are replaced (the old ones are not freed)
+ * @param capacity The number of slots (a power of two, at least one group)
+ * @return true on success, false if allocation failed (st is unchanged)
+ */
+static bool swissAllocate(SwissTable* st, size_t capacity) {
+    // The SSE2 loads need 16-byte aligned groups
+    int8_t* control = (int8_t*)aligned_alloc(SWISS_GROUP_WIDTH, capacity);
+    SwissSlot* slots = (SwissSlot*)malloc(capacity * sizeof(SwissSlot));
+    if (control == NULL || slots == NULL) {
+        free(control);
+        free(slots);
+        return false;
+    }
+    memset(control, SWISS_EMPTY, capacity);
+
+    st->control = control;
+    st->slots = slots;
+    st->capacity = capacity;
+    st->growthLeft = capacity - capacity / 8 - st->size;
+    return true;
+}
+
+/**
+ * Find the first free (EMPTY or DELETED) slot on a key's probe sequence
+ * 
+ * Groups are visited in triangular order (1, 2, 3... groups apart), which
+ * reaches every group of a power-of-two table. The table always has at
+ * least one EMPTY slot, so the loop terminates.
+ */
+static size_t swissFindFree(const SwissTable* st, uint64_t hashValue) {
+    size_t groupMask = st->capacity / SWISS_GROUP_WIDTH - 1;
+    size_t group = swissFirstGroup(st, hashValue);
+    for (size_t step = 1;; step++) {
+        uint32_t freeSlots = swissMatchFree(&st->control[group * SWISS_GROUP_WIDTH]);
+        if (freeSlots != 0) {
+            return group * SWISS_GROUP_WIDTH + (size_t)__builtin_ctz(freeSlots);
+        }
+        group = (group + step) & groupMask;
+    }
+}
+
+/**
+ * Find the slot holding a key
+ * 
+ * @return The index of the slot, or -1 if the key is not present
+ */
+static long swissFind(const SwissTable* st, const void* key, size_t length, uint64_t hashValue) {
+    size_t groupMask = st->capacity / SWISS_GROUP_WIDTH - 1;
+    size_t group = swissFirstGroup(st, hashValue);
+    int8_t tag = swissTag(hashValue);
+
+    for (size_t step = 1;; step++) {
+        const int8_t* control = &st->control[group * SWISS_GROUP_WIDTH];
+
+        // Only the slots whose tag matches need to be compared (1 in 128 false positives)
+        uint32_t candidates = swissMatch(control, tag);
+        while (candidates != 0) {
+            size_t index = group * SWISS_GROUP_WIDTH + (size_t)__builtin_ctz(candidates);
+            const SwissSlot* slot = &st->slots[index];
+            if (slot->hash == hashValue && slot->keyLength == length && memcmp(slot->key, key, length) == 0) {
+                return (long)index;
+            }
+            candidates &= candidates - 1;  // Clear the lowest set bit
+        }
+
+        // An EMPTY slot ends every probe sequence that reaches this group
+        if (swissMatch(control, SWISS_EMPTY) != 0) {
+            return -1;
+        }
+        group = (group + step) & groupMask;
+    }
+}
+
+/**
+ * Rebuild the table into new arrays, dropping all tombstones
+ * 
+ * Doubles the capacity when the table is genuinely full, otherwise rebuilds
+ * at the same capacity to reclaim the DELETED slots.
+ */
+static bool swissRehash(SwissTable* st) {
+    size_t newCapacity = st->capacity;
+    if (st->size >= newCapacity / 2 - newCapacity / 16) {
+        newCapacity *= 2;
+    }
+
+    int8_t* oldControl = st->control;
+    SwissSlot* oldSlots = st->slots;
+    size_t oldCapacity = st->capacity;
+    if (!swissAllocate(st, newCapacity)) {
+        return false;
+    }
+
+    // Keys are known to be unique, so each one goes to its first free slot
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (oldControl[i] >= 0) {
+            size_t index = swissFindFree(st, oldSlots[i].hash);
+            st->control[index] = oldControl[i];
+            st->slots[index] = oldSlots[i];
+        }
+    }
+
+    free(oldControl);
+    free(oldSlots);
+    return true;
+}
+
+/**
+ * Create a new SwissTable
+ * 
+ * @param capacity The expected number of entries (the table grows as needed)
+ * @return A pointer to the new table, or NULL if allocation fails
+ */
+SwissTable* createSwissTable(size_t capacity) {
+    SwissTable* st = (SwissTable*)malloc(sizeof(SwissTable));
+    if (st == NULL) {
+        return NULL;
+    }
+
+    // Room for the requested entries at a 7/8 load, rounded to whole groups
+    size_t slots = SWISS_GROUP_WIDTH;
+    while (slots - slots / 8 < capacity) {
+        slots *= 2;
+    }
+
+    st->size = 0;
+    if (!swissAllocate(st, slots)) {
+        free(st);
+        return NULL;
+    }
+    return st;
+}
+
+/**
+ * Insert a key-value pair with a key of known length into a SwissTable
+ * 
+ * If the key already exists, its value is updated. The key may contain
+ * zero bytes and does not need to be NUL-terminated.
+ * 
+ * @param st The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool swissInsertBytes(SwissTable* st, const void* key, size_t length, void* value) {
+    uint64_t hashValue = hashWy(key, length);
+
+    long existing = swissFind(st, key, length, hashValue);
+    if (existing >= 0) {
+        st->slots[existing].value = value;
+        return true;
+    }
+
+    char* copy = (char*)malloc(length + 1);
+    if (copy == NULL) {
+        return false;
+    }
+    memcpy(copy, key, length);
+    copy[length] = '\0';
+
+    // Reusing a tombstone is free; consuming an EMPTY slot needs growth budget
+    size_t index = swissFindFree(st, hashValue);
+    if (st->control[index] == SWISS_EMPTY && st->growthLeft == 0) {
+        if (!swissRehash(st)) {
+            free(copy);
+            return false;
+        }
+        index = swissFindFree(st, hashValue);
+    }
+    if (st->control[index] == SWISS_EMPTY) {
+        st->growthLeft--;
+    }
+
+    st->control[index] = swissTag(hashValue);
+    st->slots[index].key = copy;
+    st->slots[index].value = value;
+    st->slots[index].hash = hashValue;
+    st->slots[index].keyLength = length;
+    st->size++;
+    return true;
+}
+
+/**
+ * Insert a key-value pair into a SwissTable
+ * 
+ * If the key already exists, its value is updated.
+ * 
+ * @param st The table
+ * @param key The string key
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool swissInsert(SwissTable* st, const char* key, void* value) {
+    return swissInsertBytes(st, key, strlen(key), value);
+}
+
+/**
+ * Retrieve a value from a SwissTable by a key of known length
+ * 
+ * @param st The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return The value associated with the key, or NULL if key not found
+ */
+void* swissGetBytes(SwissTable* st, const void* key, size_t length) {
+    long index = swissFind(st, key, length, hashWy(key, length));
+    return index >= 0 ? st->slots[index].value : NULL;
+}
+
+/**
+ * Retrieve a value from a SwissTable by its key
+ * 
+ * @param st The table
+ * @param key The key to look up
+ * @return The value associated with the key, or NULL if key not found
+ */
+void* swissGet(SwissTable* st, const char* key) {
+    return swissGetBytes(st, key, strlen(key));
+}
+
+/**
+ * Delete a key-value pair from a SwissTable by a key of known length
+ * 
+ * A slot can go straight back to EMPTY when its group still has another
+ * EMPTY slot: no probe sequence can then continue past this group, so no
+ * other key depends on the slot. Otherwise it becomes a tombstone, which
+ * lookups skip and inserts reuse.
+ * 
+ * @param st The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return true if key was found and deleted, false if key not found
+ */
+bool swissDeleteBytes(SwissTable* st, const void* key, size_t length) {
+    long index = swissFind(st, key, length, hashWy(key, length));
+    if (index < 0) {
+        return false;
+    }
+
+    free(st->slots[index].key);
+    const int8_t* group = &st->control[(size_t)index & ~(size_t)(SWISS_GROUP_WIDTH - 1)];
+    if (swissMatch(group, SWISS_EMPTY) != 0) {
+        st->control[index] = SWISS_EMPTY;
+        st->growthLeft++;
+    } else {
+        st->control[index] = SWISS_DELETED;
+    }
+    st->size--;
+    return true;
+}
+
+/**
+ * Delete a key-value pair from a SwissTable
+ * 
+ * @param st The table
+ * @param key The key to delete
+ * @return true if key was found and deleted, false if key not found
+ */
+bool swissDelete(SwissTable* st, const char* key) {
+    return swissDeleteBytes(st, key, strlen(key));
+}
+
+/**
+ * Free all memory used by a SwissTable
+ * 
+ * @param st The table to free
+ */
+void freeSwissTable(SwissTable* st) {
+    if (st == NULL) return;
+
+    for (size_t i = 0; i < st->capacity; i++) {
+        if (st->control[i] >= 0) {
+            free(st->slots[i].key);
+        }
+    }
+    free(st->control);
+    free(st->slots);
+    free(st);
+}
+
+/**
+ * Open-Addressing Engine: Robin Hood Hashing
+ * 
+ * A linear-probing table in which every entry remembers how far it sits
+ * from its home slot (its probe distance). On insert, an entry that has
+ * travelled further than the one occupying a slot takes that slot, and the
+ * displaced entry continues probing ("take from the rich, give to the
+ * poor"). This keeps probe distances short and nearly equal even at high
+ * load factors, and a lookup can stop as soon as it meets an entry closer
+ * to its home than the key would be - misses do not scan to an empty slot.
+ * Deletion shifts the following entries back by one instead of leaving
+ * tombstones, so the table never degrades with churn.
+ */
+#define DEFAULT_ROBIN_HOOD_MAX_LOAD_FACTOR 0.9
+#define MAX_ROBIN_HOOD_LOAD_FACTOR 0.97     // Above this probe sequences blow up regardless
+
+/**
+ * RobinHoodSlot Structure
+ */
+typedef struct RobinHoodSlot {
+    char* key;          // A copy of the key
+    void* value;        // A pointer to the value
+    uint64_t hash;      // The full hash of the key
+    size_t keyLength;   // The length of the key
+    uint32_t distance;  // Probe length: 1 in the home slot, 2 one slot further... 0 when empty
+} RobinHoodSlot;
+
+/**
+ * RobinHoodTable Structure
+ */
+typedef struct RobinHoodTable {
+    RobinHoodSlot* slots; // The entries (capacity of them)
+    size_t capacity;    // The number of slots (a power of two)
+    size_t size;        // The number of entries stored
+    double maxLoadFactor; // Grow when size/capacity would rise above this
+} RobinHoodTable;
+
+/**
+ * RobinHoodStats Structure
+ * 
+ * Probe-length figures filled in by getRobinHoodStats(). The probe length
+ * of an entry is the number of slots a successful lookup inspects.
+ */
+typedef struct RobinHoodStats {
+    size_t size;        // The number of entries
+    size_t capacity;    // The number of slots
+    uint32_t maxProbeLength;  // The longest probe sequence of any entry
+    double meanProbeLength;   // The average probe length over all entries
+} RobinHoodStats;
+
+/**
+ * Place an entry, displacing richer entries along the way
+ * 
+ * The key must not be present. Used by both insert and rebuild.
+ */
+static void robinHoodPlace(RobinHoodTable* rt, RobinHoodSlot entry) {
+    size_t mask = rt->capacity - 1;
+    size_t index = (size_t)entry.hash & mask;
+    entry.distance = 1;
+
+    while (rt->slots[index].distance != 0) {
+        if (rt->slots[index].distance < entry.distance) {
+            // The resident is closer to home than we are: swap and carry it on
+            RobinHoodSlot displaced = rt->slots[index];
+            rt->slots[index] = entry;
+            entry = displaced;
+        }
+        index = (index + 1) & mask;
+        entry.distance++;
+    }
+    rt->slots[index] = entry;
+}
+
+/**
+ * Find the slot holding a key
+ * 
+ * @return The index of the slot, or -1 if the key is not present
+ */
+static long robinHoodFind(const RobinHoodTable* rt, const void* key, size_t length, uint64_t hashValue) {
+    size_t mask = rt->capacity - 1;
+    size_t index = (size_t)hashValue & mask;
+
+    // Once a resident is closer to its home than we are to ours, the key would have displaced it
+    for (uint32_t distance = 1; rt->slots[index].distance >= distance; distance++) {
+        const RobinHoodSlot* slot = &rt->slots[index];
+        if (slot->hash == hashValue && slot->keyLength == length && memcmp(slot->key, key, length) == 0) {
+            return (long)index;
+        }
+        index = (index + 1) & mask;
+    }
+    return -1;
+}
+
+/**
+ * Move every entry into a slot array of a new capacity
+ */
+static bool robinHoodResize(RobinHoodTable* rt, size_t newCapacity) {
+    RobinHoodSlot* newSlots = (RobinHoodSlot*)calloc(newCapacity, sizeof(RobinHoodSlot));
+    if (newSlots == NULL) {
+        return false;
+    }
+
+    RobinHoodSlot* oldSlots = rt->slots;
+    size_t oldCapacity = rt->capacity;
+    rt->slots = newSlots;
+    rt->capacity = newCapacity;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i].distance != 0) {
+            robinHoodPlace(rt, oldSlots[i]);
+        }
+    }
+
+    free(oldSlots);
+    return true;
+}
+
+/**
+ * Create a new RobinHoodTable
+ * 
+ * @param capacity The expected number of entries (the table grows as needed)
+ * @return A pointer to the new table, or NULL if allocation fails
+ */
+RobinHoodTable* createRobinHoodTable(size_t capacity) {
+    RobinHoodTable* rt = (RobinHoodTable*)malloc(sizeof(RobinHoodTable));
+    if (rt == NULL) {
+        return NULL;
+    }
+    rt->maxLoadFactor = DEFAULT_ROBIN_HOOD_MAX_LOAD_FACTOR;
+    rt->size = 0;
+
+    rt->capacity = 8;
+    while (rt->capacity * rt->maxLoadFactor < capacity) {
+        rt->capacity *= 2;
+    }
+    rt->slots = (RobinHoodSlot*)calloc(rt->capacity, sizeof(RobinHoodSlot));
+    if (rt->slots == NULL) {
+        free(rt);
+        return NULL;
+    }
+    return rt;
+}
+
+/**
+ * Configure the load factor at which a RobinHoodTable grows
+ * 
+ * @param rt The table
+ * @param maxLoadFactor The new threshold (above 0, at most 0.97)
+ * @return true if the threshold was accepted, false if it is invalid
+ */
+bool setRobinHoodMaxLoadFactor(RobinHoodTable* rt, double maxLoadFactor) {
+    if (maxLoadFactor <= 0.0 || maxLoadFactor > MAX_ROBIN_HOOD_LOAD_FACTOR) {
+        return false;
+    }
+    rt->maxLoadFactor = maxLoadFactor;
+    return true;
+}
+
+/**
+ * Insert a key-value pair with a key of known length into a RobinHoodTable
+ * 
+ * If the key already exists, its value is updated. The key may contain
+ * zero bytes and does not need to be NUL-terminated.
+ * 
+ * @param rt The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool robinHoodInsertBytes(RobinHoodTable* rt, const void* key, size_t length, void* value) {
+    uint64_t hashValue = hashWy(key, length);
+
+    long existing = robinHoodFind(rt, key, length, hashValue);
+    if (existing >= 0) {
+        rt->slots[existing].value = value;
+        return true;
+    }
+
+    if (rt->size + 1 > rt->capacity * rt->maxLoadFactor) {
+        if (!robinHoodResize(rt, rt->capacity * 2)) {
+            return false;
+        }
+    }
+
+    RobinHoodSlot entry;
+    entry.key = (char*)malloc(length + 1);
+    if (entry.key == NULL) {
+        return false;
+    }
+    memcpy(entry.key, key, length);
+    entry.key[length] = '\0';
+    entry.value = value;
+    entry.hash = hashValue;
+    entry.keyLength = length;
+    robinHoodPlace(rt, entry);
+    rt->size++;
+    return true;
+}
+
+/**
+ * Insert a key-value pair into a RobinHoodTable
+ * 
+ * If the key already exists, its value is updated.
+ * 
+ * @param rt The table
+ * @param key The string key
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool robinHoodInsert(RobinHoodTable* rt, const char* key, void* value) {
+    return robinHoodInsertBytes(rt, key, strlen(key), value);
+}
+
+/**
+ * Retrieve a value from a RobinHoodTable by a key of known length
+ * 
+ * @param rt The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return The value associated with the key, or NULL if key not found
+ */
+void* robinHoodGetBytes(RobinHoodTable* rt, const void* key, size_t length) {
+    long index = robinHoodFind(rt, key, length, hashWy(key, length));
+    return index >= 0 ? rt->slots[index].value : NULL;
+}
+
+/**
+ * Retrieve a value from a RobinHoodTable by its key
+ * 
+ * @param rt The table
+ * @param key The key to look up
+ * @return The value associated with the key, or NULL if key not found
+ */
+void* robinHoodGet(RobinHoodTable* rt, const char* key) {
+    return robinHoodGetBytes(rt, key, strlen(key));
+}
+
+/**
+ * Delete a key-value pair from a RobinHoodTable by a key of known length
+ * 
+ * The entries after the deleted one are shifted back by one slot until an
+ * empty slot or an entry already in its home slot is reached. Each shifted
+ * entry gets one step closer to home, and no tombstone is left behind.
+ * 
+ * @param rt The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return true if key was found and deleted, false if key not found
+ */
+bool robinHoodDeleteBytes(RobinHoodTable* rt, const void* key, size_t length) {
+    long found = robinHoodFind(rt, key, length, hashWy(key, length));
+    if (found < 0) {
+        return false;
+    }
+
+    size_t mask = rt->capacity - 1;
+    size_t index = (size_t)found;
+    free(rt->slots[index].key);
+
+    size_t next = (index + 1) & mask;
+    while (rt->slots[next].distance > 1) {
+        rt->slots[index] = rt->slots[next];
+        rt->slots[index].distance--;
+        index = next;
+        next = (next + 1) & mask;
+    }
+    rt->slots[index].distance = 0;
+    rt->size--;
+    return true;
+}
+
+/**
+ * Delete a key-value pair from a RobinHoodTable
+ * 
+ * @param rt The table
+ * @param key The key to delete
+ * @return true if key was found and deleted, false if key not found
+ */
+bool robinHoodDelete(RobinHoodTable* rt, const char* key) {
+    return robinHoodDeleteBytes(rt, key, strlen(key));
+}
+
+/**
+ * Collect probe-length statistics of a RobinHoodTable
+ * 
+ * @param rt The table
+ * @param stats Filled in with the size, capacity and probe lengths
+ */
+void getRobinHoodStats(RobinHoodTable* rt, RobinHoodStats* stats) {
+    uint64_t total = 0;
+    stats->size = rt->size;
+    stats->capacity = rt->capacity;
+    stats->maxProbeLength = 0;
+
+    for (size_t i = 0; i < rt->capacity; i++) {
+        uint32_t distance = rt->slots[i].distance;
+        total += distance;
+        if (distance > stats->maxProbeLength) {
+            stats->maxProbeLength = distance;
+        }
+    }
+    stats->meanProbeLength = rt->size > 0 ? (double)total / rt->size : 0.0;
+}
+
+/**
+ * Free all memory used by a RobinHoodTable
+ * 
+ * @param rt The table to free
+ */
+void freeRobinHoodTable(RobinHoodTable* rt) {
+    if (rt == NULL) return;
+
+    for (size_t i = 0; i < rt->capacity; i++) {
+        if (rt->slots[i].distance != 0) {
+            free(rt->slots[i].key);
+        }
+    }
+    free(rt->slots);
+    free(rt);
+}
+
+/**
+ * Epoch-Based Reclamation
+ * 
+ * Lets readers walk shared nodes without taking any lock. A reader
+ * announces itself by incrementing a counter for the current epoch (one of
+ * two, by parity) before it touches shared memory and decrements it when it
+ * is done. A writer that unlinks a node cannot free it immediately, since a
+ * reader may still be looking at it; it retires the node instead, pushing
+ * it onto the domain's retired list with a CAS. Every EPOCH_RETIRE_BATCH
+ * retirements the retiring thread tries to advance the global epoch, which
+ * only succeeds once no reader is left in the epoch before the current
+ * one; each advance frees what was retired before the previous advance.
+ * Nothing ever waits: while a reader lingers, attempts simply give up and
+ * a later one frees the memory.
+ * 
+ * Readers are spread over EPOCH_READER_SLOTS cache-line-sized counters by
+ * thread, so entering and leaving is two uncontended atomic increments.
+ */
+#include <pthread.h>    // For pthread_mutex_t and the threads of the concurrent tables
+
+#define EPOCH_READER_SLOTS 64       // Counters readers are spread over
+#define EPOCH_RETIRE_BATCH 256      // Retired items between two attempts to advance the epoch
+
+/**
+ * EpochSlot Structure
+ * 
+ * The number of readers inside each of the two epoch parities. Several
+ * threads may share a slot; they simply share the counters.
+ */
+typedef struct EpochSlot {
+    _Alignas(CACHE_LINE_SIZE) long active[2];
+} EpochSlot;
+
+/**
+ * RetiredItem Structure
+ * 
+ * A pointer that has been unlinked but may still be in use by a reader,
+ * and the function that frees it once that is no longer possible.
+ */
+typedef struct RetiredItem {
+    void* pointer;
+    void (*reclaim)(void* pointer, void* context);
+    void* context;
+    struct RetiredItem* next;   // The item retired before it
+} RetiredItem;
+
+/**
+ * EpochDomain Structure
+ */
+typedef struct EpochDomain {
+    EpochSlot slots[EPOCH_READER_SLOTS]; // Reader counters
+    unsigned long epoch;        // The global epoch; only its parity matters to readers
+    RetiredItem* retired;       // Items retired since the last advance (pushed with a CAS)
+    size_t retiredCount;        // Items retired since the last advance (approximate)
+    RetiredItem* limbo;         // Items retired before the last advance, freed by the next one
+    bool reclaiming;            // Set while a thread attempts an advance; others skip theirs
+} EpochDomain;
+
+// Each thread picks a reader slot once, round-robin
+static _Thread_local int epochThreadSlot = -1;
+static int epochNextSlot = 0;
+
+/**
+ * Create an epoch domain (one per shared data structure)
+ * 
+ * @return The new domain, or NULL if allocation fails
+ */
+EpochDomain* createEpochDomain(void) {
+    EpochDomain* domain = (EpochDomain*)aligned_alloc(CACHE_LINE_SIZE,
+        (sizeof(EpochDomain) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+    if (domain == NULL) {
+        return NULL;
+    }
+    memset(domain, 0, sizeof(EpochDomain));
+    return domain;
+}
+
+/**
+ * Enter a read-side critical section
+ * 
+ * Nodes reachable from the shared structure stay allocated until the
+ * matching epochExit().
+ * 
+ * @param domain The domain
+ * @return A token to pass to epochExit()
+ */
+static inline long* epochEnter(EpochDomain* domain) {
+    if (epochThreadSlot < 0) {
+        epochThreadSlot = __atomic_fetch_add(&epochNextSlot, 1, __ATOMIC_RELAXED) % EPOCH_READER_SLOTS;
+    }
+    EpochSlot* slot = &domain->slots[epochThreadSlot];
+
+    for (;;) {
+        unsigned long epoch = __atomic_load_n(&domain->epoch, __ATOMIC_SEQ_CST);
+        long* counter = &slot->active[epoch & 1];
+        __atomic_fetch_add(counter, 1, __ATOMIC_SEQ_CST);
+
+        // If the epoch moved before we were counted, a reclaimer may not have seen us
+        if (__atomic_load_n(&domain->epoch, __ATOMIC_SEQ_CST) == epoch) {
+            return counter;
+        }
+        __atomic_fetch_sub(counter, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/**
+ * Leave a read-side critical section
+ * 
+ * @param domain The domain
+ * @param token The value returned by epochEnter()
+ */
+static inline void epochExit(EpochDomain* domain, long* token) {
+    (void)domain;
+    __atomic_fetch_sub(token, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Free a list of retired items
+ */
+static void freeRetiredItems(RetiredItem* item) {
+    while (item != NULL) {
+        RetiredItem* next = item->next;
+        item->reclaim(item->pointer, item->context);
+        free(item);
+        item = next;
+    }
+}
+
+/**
+ * Try to advance the epoch, freeing whatever no reader can still see
+ * 
+ * The epoch moves from E to E + 1 only if no reader is left in E - 1,
+ * whose counters E + 1 reuses; otherwise the attempt gives up at once.
+ * After such an advance no reader from before the previous one remains,
+ * so the items retired before it (the limbo) are freed, and the items
+ * retired since take their place. If another thread is already attempting
+ * an advance, this returns at once as well.
+ * 
+ * Never blocks, so it may be called from anywhere, even inside a critical
+ * section.
+ * 
+ * @param domain The domain
+ * @return true if the epoch advanced
+ */
+bool epochReclaim(EpochDomain* domain) {
+    bool idle = false;
+    if (!__atomic_compare_exchange_n(&domain->reclaiming, &idle, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    unsigned long epoch = __atomic_load_n(&domain->epoch, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < EPOCH_READER_SLOTS; i++) {
+        if (__atomic_load_n(&domain->slots[i].active[(epoch + 1) & 1], __ATOMIC_SEQ_CST) != 0) {
+            __atomic_store_n(&domain->reclaiming, false, __ATOMIC_RELEASE);
+            return false;  // A reader from the previous epoch is still inside
+        }
+    }
+
+    RetiredItem* expired = domain->limbo;
+    domain->limbo = __atomic_exchange_n(&domain->retired, NULL, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&domain->retiredCount, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&domain->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&domain->reclaiming, false, __ATOMIC_RELEASE);
+
+    freeRetiredItems(expired);
+    return true;
+}
+
+/**
+ * Hand an unlinked pointer to the domain to be freed after a grace period
+ * 
+ * Lock-free: the item is pushed onto the retired list with a CAS, and
+ * every EPOCH_RETIRE_BATCH items the calling thread tries to advance the
+ * epoch (see epochReclaim).
+ * 
+ * @param domain The domain
+ * @param pointer The unlinked memory
+ * @param reclaim The function that frees it
+ * @param context Passed through to reclaim
+ */
+void epochRetire(EpochDomain* domain, void* pointer, void (*reclaim)(void*, void*), void* context) {
+    RetiredItem* item = (RetiredItem*)malloc(sizeof(RetiredItem));
+    if (item == NULL) {
+        return;  // Out of memory: with no way to wait for the readers, leaking is the only safe option
+    }
+    item->pointer = pointer;
+    item->reclaim = reclaim;
+    item->context = context;
+    item->next = __atomic_load_n(&domain->retired, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&domain->retired, &item->next, item, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        // item->next now holds the current head; try again on top of it
+    }
+
+    if (__atomic_add_fetch(&domain->retiredCount, 1, __ATOMIC_RELAXED) % EPOCH_RETIRE_BATCH == 0) {
+        epochReclaim(domain);
+    }
+}
+
+/**
+ * Free an epoch domain and everything still retired in it
+ * 
+ * No other thread may be using the domain.
+ * 
+ * @param domain The domain to free
+ */
+void freeEpochDomain(EpochDomain* domain) {
+    if (domain == NULL) return;
+
+    freeRetiredItems(domain->limbo);
+    freeRetiredItems(domain->retired);
+    free(domain);
+}
+
+/**
+ * Concurrent Front-End: Lock-Striped HashTable
+ * 
+ * A HashTable shared between threads. Instead of one mutex around the whole
+ * table, the buckets are divided among a fixed number of lock stripes:
+ * stripe i guards every bucket whose index is i modulo the stripe count.
+ * Inserts and deletes take their stripe's lock, so writers on different
+ * stripes never contend.
+ * 
+ * Lookups take no lock at all. Writers publish nodes with release stores
+ * and readers follow the chains with acquire loads; a deleted node is
+ * retired to the table's epoch domain rather than freed, so a reader still
+ * standing on it stays safe. A lookup therefore never writes to a shared
+ * cache line apart from its own reader-slot counter.
+ * 
+ * The table uses mask indexing with a power-of-two stripe count no larger
+ * than the capacity, so a key's stripe (the low bits of its hash) is the
+ * same before and after every resize. A resize takes every stripe lock in
+ * order and builds the doubled bucket array from copies of the nodes,
+ * leaving the old array and its chains untouched. Readers find the array
+ * through one published BucketArray pointer: one that loaded the old array
+ * keeps searching it, still intact, while the resize runs, and it is
+ * retired with the old nodes once the new one is published. Lookups never
+ * wait for a resize; a resize briefly needs room for two copies of the
+ * nodes.
+ */
+#define DEFAULT_LOCK_STRIPES 64     // Enough stripes that 32 threads rarely collide
+
+/**
+ * LockStripe Structure
+ * 
+ * One lock and the number of elements in the buckets it guards. Each stripe
+ * sits on its own cache line so that threads working on neighbouring stripes
+ * do not bounce a shared line between cores.
+ */
+typedef struct LockStripe {
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t lock; // Serializes writers of the stripe's buckets
+    long count;         // Elements in the stripe's buckets (written under the lock)
+} LockStripe;
+
+/**
+ * BucketArray Structure
+ * 
+ * A bucket array together with its capacity, published to readers as one
+ * pointer so that they never pair an array with another array's capacity.
+ */
+typedef struct BucketArray {
+    KeyValuePair** buckets;     // The table's array at the time
+    int capacity;               // The number of buckets in it
+    HashTable* table;           // The table whose nodes the chains hold
+} BucketArray;
+
+/**
+ * ConcurrentHashTable Structure
+ */
+typedef struct ConcurrentHashTable {
+    HashTable* table;   // The buckets and nodes (its size field is not maintained)
+    LockStripe* stripes; // The lock stripes
+    int stripeCount;    // The number of stripes (a power of two)
+    BucketArray* buckets; // The current array, as readers see it
+    EpochDomain* epoch; // Defers freeing nodes and bucket arrays readers may still see
+} ConcurrentHashTable;
+
+/**
+ * Create a new ConcurrentHashTable
+ * 
+ * @param capacity The initial number of buckets
+ * @param stripeCount The number of lock stripes (rounded up to a power of two), or 0 for the default
+ * @return A pointer to the new table, or NULL if allocation fails
+ */
+ConcurrentHashTable* createConcurrentHashTable(int capacity, int stripeCount) {
+    if (stripeCount <= 0) {
+        stripeCount = DEFAULT_LOCK_STRIPES;
+    }
+    int stripes = 1;
+    while (stripes < stripeCount && stripes < MAX_POWER_OF_TWO_CAPACITY) {
+        stripes *= 2;
+    }
+    if (capacity < stripes) {
+        capacity = stripes;  // Every bucket must belong to exactly one stripe
+    }
+
+    ConcurrentHashTable* cht = (ConcurrentHashTable*)malloc(sizeof(ConcurrentHashTable));
+    if (cht == NULL) {
+        return NULL;
+    }
+    cht->table = createHashTable(capacity);
+    cht->stripes = (LockStripe*)aligned_alloc(CACHE_LINE_SIZE, stripes * sizeof(LockStripe));
+    cht->buckets = (BucketArray*)malloc(sizeof(BucketArray));
+    cht->epoch = createEpochDomain();
+    if (cht->table == NULL || cht->stripes == NULL || cht->buckets == NULL || cht->epoch == NULL ||
+        !setIndexMode(cht->table, INDEX_MASK)) {
+        freeHashTable(cht->table);
+        free(cht->stripes);
+        free(cht->buckets);
+        freeEpochDomain(cht->epoch);
+        free(cht);
+        return NULL;
+    }
+
+    cht->stripeCount = stripes;
+    cht->buckets->buckets = cht->table->array;
+    cht->buckets->capacity = cht->table->capacity;
+    cht->buckets->table = cht->table;
+    for (int i = 0; i < stripes; i++) {
+        pthread_mutex_init(&cht->stripes[i].lock, NULL);
+        cht->stripes[i].count = 0;
+    }
+    return cht;
+}
+
+// The stripe that guards a key's bucket
+static inline LockStripe* stripeFor(ConcurrentHashTable* cht, uint64_t hashValue) {
+    return &cht->stripes[hashValue & (uint64_t)(cht->stripeCount - 1)];
+}
+
+// Reclaim callbacks for the epoch domain
+static void reclaimPair(void* pair, void* ht) {
+    releasePair((HashTable*)ht, (KeyValuePair*)pair);
+}
+
+// Free a bucket array that has been replaced, with the nodes it chained
+// (their long keys were handed on to the copies)
+static void reclaimBuckets(void* pointer, void* unused) {
+    (void)unused;
+    BucketArray* old = (BucketArray*)pointer;
+    for (int i = 0; i < old->capacity; i++) {
+        KeyValuePair* current = old->buckets[i];
+        while (current != NULL) {
+            KeyValuePair* next = current->next;
+            freeNode(old->table, current);
+            current = next;
+        }
+    }
+    free(old->buckets);
+    free(old);
+}
+
+/**
+ * Double the bucket count while holding every stripe
+ * 
+ * Each node is copied into the new array; the old array and its chains
+ * are not written to, so readers still walking them find every key that
+ * was there when the resize started. The new array is published with one
+ * pointer store and the old one retired, not freed. If memory runs out the
+ * table simply stays at its current size.
+ * 
+ * @param cht The table
+ * @param observedCapacity The capacity that was found to be too small; if
+ *        another thread has resized in the meantime nothing is done
+ */
+static void concurrentGrow(ConcurrentHashTable* cht, int observedCapacity) {
+    HashTable* ht = cht->table;
+
+    // Always in stripe order, so two resizing threads cannot deadlock
+    for (int i = 0; i < cht->stripeCount; i++) {
+        pthread_mutex_lock(&cht->stripes[i].lock);
+    }
+
+    KeyValuePair** newArray = NULL;
+    BucketArray* published = NULL;
+    int newCapacity = observedCapacity * 2;
+    if (ht->capacity == observedCapacity && newCapacity <= MAX_POWER_OF_TWO_CAPACITY) {
+        newArray = (KeyValuePair**)calloc((size_t)newCapacity, sizeof(KeyValuePair*));
+        published = (BucketArray*)malloc(sizeof(BucketArray));
+    }
+
+    bool copied = newArray != NULL && published != NULL;
+    for (int i = 0; copied && i < observedCapacity; i++) {
+        for (KeyValuePair* current = ht->array[i]; current != NULL; current = current->next) {
+            KeyValuePair* copy = allocPair(ht);
+            if (copy == NULL) {
+                copied = false;
+                break;
+            }
+            *copy = *current;
+            if (current->key == current->inlineKey) {
+                copy->key = copy->inlineKey;
+            }
+            int index = indexFor(ht, copy->hash, newCapacity);
+            copy->next = newArray[index];
+            newArray[index] = copy;
+        }
+    }
+
+    BucketArray* old = cht->buckets;
+    if (copied) {
+        ht->array = newArray;
+        ht->capacity = newCapacity;
+        published->buckets = newArray;
+        published->capacity = newCapacity;
+        published->table = ht;
+        __atomic_store_n(&cht->buckets, published, __ATOMIC_RELEASE);
+    } else if (newArray != NULL) {
+        // Out of memory: drop the copies made so far (their keys belong to the originals)
+        for (int i = 0; i < newCapacity; i++) {
+            while (newArray[i] != NULL) {
+                KeyValuePair* next = newArray[i]->next;
+                freeNode(ht, newArray[i]);
+                newArray[i] = next;
+            }
+        }
+    }
+
+    for (int i = cht->stripeCount - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&cht->stripes[i].lock);
+    }
+
+    if (copied) {
+        epochRetire(cht->epoch, old, reclaimBuckets, NULL);
+    } else {
+        free(newArray);
+        free(published);
+    }
+}
+
+/**
+ * Insert a key-value pair with a key of known length
+ * 
+ * Takes the key's stripe lock. Growth is decided per stripe: each stripe
+ * owns capacity/stripeCount buckets, and the table doubles once any
+ * stripe's share exceeds the maximum load factor.
+ * 
+ * @param cht The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool concurrentInsertBytes(ConcurrentHashTable* cht, const void* key, size_t length, void* value) {
+    HashTable* ht = cht->table;
+    uint64_t hashValue = ht->hashFunction(key, length);
+    LockStripe* stripe = stripeFor(cht, hashValue);
+
+    pthread_mutex_lock(&stripe->lock);
+    KeyValuePair** link = findLink(ht, key, length, hashValue);
+    if (link != NULL) {
+        __atomic_store_n(&(*link)->value, value, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&stripe->lock);
+        return true;
+    }
+
+    KeyValuePair* newPair = createPair(ht, key, length, hashValue, value);
+    if (newPair == NULL) {
+        pthread_mutex_unlock(&stripe->lock);
+        return false;
+    }
+    int index = indexFor(ht, hashValue, ht->capacity);
+    newPair->next = ht->array[index];
+
+    // Publish the fully initialized node: readers that see it see its fields
+    __atomic_store_n(&ht->array[index], newPair, __ATOMIC_RELEASE);
+    __atomic_store_n(&stripe->count, stripe->count + 1, __ATOMIC_RELAXED);
+
+    int capacity = ht->capacity;
+    bool tooFull = stripe->count > (double)capacity / cht->stripeCount * ht->maxLoadFactor;
+    pthread_mutex_unlock(&stripe->lock);
+
+    if (tooFull) {
+        concurrentGrow(cht, capacity);
+    }
+    return true;
+}
+
+/**
+ * Retrieve a value by a key of known length
+ * 
+ * Lock-free and wait-free: the bucket array and chain are read with
+ * acquire loads inside an epoch critical section, and a lookup that
+ * overlaps a resize searches whichever array it found, without retrying.
+ * 
+ * @param cht The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return The value associated with the key, or NULL if key not found
+ */
+void* concurrentGetBytes(ConcurrentHashTable* cht, const void* key, size_t length) {
+    HashTable* ht = cht->table;
+    uint64_t hashValue = ht->hashFunction(key, length);
+    void* value = NULL;
+
+    long* token = epochEnter(cht->epoch);
+    BucketArray* buckets = __atomic_load_n(&cht->buckets, __ATOMIC_ACQUIRE);
+    KeyValuePair* current = __atomic_load_n(&buckets->buckets[indexFor(ht, hashValue, buckets->capacity)],
+                                            __ATOMIC_ACQUIRE);
+    while (current != NULL && !pairMatches(current, key, length, hashValue)) {
+        current = __atomic_load_n(&current->next, __ATOMIC_ACQUIRE);
+    }
+    if (current != NULL) {
+        value = __atomic_load_n(&current->value, __ATOMIC_ACQUIRE);
+    }
+    epochExit(cht->epoch, token);
+    return value;
+}
+
+/**
+ * Delete a key-value pair by a key of known length
+ * 
+ * The node is unlinked under the stripe lock and retired; it is freed once
+ * no reader can still be looking at it.
+ * 
+ * @param cht The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return true if key was found and deleted, false if key not found
+ */
+bool concurrentDeleteBytes(ConcurrentHashTable* cht, const void* key, size_t length) {
+    HashTable* ht = cht->table;
+    uint64_t hashValue = ht->hashFunction(key, length);
+    LockStripe* stripe = stripeFor(cht, hashValue);
+
+    pthread_mutex_lock(&stripe->lock);
+    KeyValuePair** link = findLink(ht, key, length, hashValue);
+    if (link == NULL) {
+        pthread_mutex_unlock(&stripe->lock);
+        return false;
+    }
+    KeyValuePair* current = *link;
+    __atomic_store_n(link, current->next, __ATOMIC_RELEASE);
+    __atomic_store_n(&stripe->count, stripe->count - 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&stripe->lock);
+
+    epochRetire(cht->epoch, current, reclaimPair, ht);
+    return true;
+}
+
+/**
+ * Insert a key-value pair into a ConcurrentHashTable
+ * 
+ * @param cht The table
+ * @param key The string key
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool concurrentInsert(ConcurrentHashTable* cht, const char* key, void* value) {
+    return concurrentInsertBytes(cht, key, strlen(key), value);
+}
+
+/**
+ * Retrieve a value from a ConcurrentHashTable by its key
+ * 
+ * @param cht The table
+ * @param key The key to look up
+ * @return The value associated with the key, or NULL if key not found
+ */
+void* concurrentGet(ConcurrentHashTable* cht, const char* key) {
+    return concurrentGetBytes(cht, key, strlen(key));
+}
+
+/**
+ * Delete a key-value pair from a ConcurrentHashTable
+ * 
+ * @param cht The table
+ * @param key The key to delete
+ * @return true if key was found and deleted, false if key not found
+ */
+bool concurrentDelete(ConcurrentHashTable* cht, const char* key) {
+    return concurrentDeleteBytes(cht, key, strlen(key));
+}
+
+/**
+ * Get the number of elements in a ConcurrentHashTable
+ * 
+ * Sums the per-stripe counters without locking, so the result is only a
+ * snapshot while other threads are inserting or deleting.
+ * 
+ * @param cht The table
+ * @return The number of elements
+ */
+long concurrentSize(ConcurrentHashTable* cht) {
+    long size = 0;
+    for (int i = 0; i < cht->stripeCount; i++) {
+        size += __atomic_load_n(&cht->stripes[i].count, __ATOMIC_RELAXED);
+    }
+    return size;
+}
+
+/**
+ * Free all memory used by a ConcurrentHashTable
+ * 
+ * No other thread may be using the table.
+ * 
+ * @param cht The table to free
+ */
+void freeConcurrentHashTable(ConcurrentHashTable* cht) {
+    if (cht == NULL) return;
+
+    for (int i = 0; i < cht->stripeCount; i++) {
+        pthread_mutex_destroy(&cht->stripes[i].lock);
+    }
+    free(cht->stripes);
+    freeEpochDomain(cht->epoch);  // Frees the retired nodes and bucket arrays
+    free(cht->buckets);
+    freeHashTable(cht->table);
+    free(cht);
+}
+
+/**
+ * Lock-Free Engine: Split-Ordered List
+ * 
+ * Shalev and Shavit's split-ordered list: every entry of the table lives in
+ * one sorted, lock-free linked list of KeyValuePairs, and the buckets are
+ * merely shortcut pointers into that list. The list is sorted by the
+ * bit-reversed hash, so the entries of bucket b (hash mod 2^k) form one
+ * contiguous run, and when the bucket count doubles, bucket b's run splits
+ * cleanly into the runs of b and b + 2^k. Growing the table therefore moves
+ * no entries at all: it only doubles the bucket count, and each new bucket
+ * is initialized lazily, the first time it is used, by inserting a dummy
+ * node (a node with no key) at the start of its run.
+ * 
+ * The list follows Harris and Michael: a node is deleted by first setting
+ * the low bit of its next pointer (a logical delete) and then unlinking it
+ * with a CAS; any thread that walks past a marked node helps unlink it.
+ * Unlinked nodes are retired to an epoch domain, whose retirement and
+ * reclamation are lock-free as well. No operation ever blocks or waits
+ * for another thread (beyond what malloc() itself does), including while
+ * the table grows.
+ * 
+ * The hash field of a regular node holds its split-order key: the reversed
+ * hash with the lowest bit set. Dummy nodes have even keys, so they sort
+ * just before the entries of their bucket.
+ */
+#define SPLIT_SEGMENT_SIZE 4096     // Buckets per lazily allocated segment
+#define SPLIT_MAX_SEGMENTS 4096     // Segments in the directory (up to 16M buckets)
+#define SPLIT_INITIAL_BUCKETS 16
+#define SPLIT_MAX_LOAD_FACTOR 2.0   // Average run length before the bucket count doubles
+
+/**
+ * SplitOrderedTable Structure
+ */
+typedef struct SplitOrderedTable {
+    KeyValuePair** segments[SPLIT_MAX_SEGMENTS]; // Bucket pointers (NULL until a bucket is initialized)
+    KeyValuePair* head;         // The dummy node of bucket 0: the start of the list
+    unsigned long bucketCount;  // The number of buckets in use (a power of two, only grows)
+    unsigned long size;         // The number of entries
+    EpochDomain* epoch;         // Defers freeing unlinked nodes
+} SplitOrderedTable;
+
+// Pointers with the low bit set mark their node as logically deleted
+static inline bool isMarked(KeyValuePair* pointer) {
+    return ((uintptr_t)pointer & 1) != 0;
+}
+
+static inline KeyValuePair* markPointer(KeyValuePair* pointer) {
+    return (KeyValuePair*)((uintptr_t)pointer | 1);
+}
+
+static inline KeyValuePair* unmarkPointer(KeyValuePair* pointer) {
+    return (KeyValuePair*)((uintptr_t)pointer & ~(uintptr_t)1);
+}
+
+// Split-order keys: odd for entries, even for the dummy node of a bucket
+static inline uint64_t regularKey(uint64_t hashValue) {
+    return reverseBits(hashValue | (1ULL << 63));
+}
+
+static inline uint64_t dummyKey(unsigned long bucket) {
+    return reverseBits((uint64_t)bucket);
+}
+
+/**
+ * Allocate a list node; a NULL key makes a dummy node
+ */
+static KeyValuePair* splitCreateNode(uint64_t sortKey, const void* key, size_t length, void* value) {
+    KeyValuePair* node = (KeyValuePair*)malloc(sizeof(KeyValuePair));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->key = NULL;
+    if (key != NULL) {
+        node->key = length < INLINE_KEY_CAPACITY ? node->inlineKey : (char*)malloc(length + 1);
+        if (node->key == NULL) {
+            free(node);
+            return NULL;
+        }
+        memcpy(node->key, key, length);
+        node->key[length] = '\0';
+    }
+    node->hash = sortKey;
+    node->keyLength = length;
+    node->value = value;
+    node->next = NULL;
+    return node;
+}
+
+// Epoch reclaim callback (also used directly for nodes that were never published)
+static void splitFreeNode(void* pointer, void* unused) {
+    (void)unused;
+    KeyValuePair* node = (KeyValuePair*)pointer;
+    if (node->key != node->inlineKey) {
+        free(node->key);
+    }
+    free(node);
+}
+
+/**
+ * Find the position of a key in the list, starting at a dummy node
+ * 
+ * Walks the list from start, unlinking any logically deleted node it
+ * passes. On return *previous is the link that points (or would point) to
+ * the key's node and *current is the first node not sorted before the key.
+ * A NULL key searches for the dummy node with the given sort key.
+ * 
+ * Must be called inside an epoch critical section.
+ * 
+ * @return true if a node with this key was found (it is *current)
+ */
+static bool splitFind(SplitOrderedTable* sot, KeyValuePair* start, uint64_t sortKey, const void* key, size_t length,
+                      KeyValuePair*** previous, KeyValuePair** current) {
+retry:
+    *previous = &start->next;
+    *current = unmarkPointer(__atomic_load_n(*previous, __ATOMIC_ACQUIRE));
+
+    for (;;) {
+        KeyValuePair* node = *current;
+        if (node == NULL) {
+            return false;
+        }
+        KeyValuePair* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+        // The predecessor changed under us (or was itself deleted): start over
+        if (__atomic_load_n(*previous, __ATOMIC_ACQUIRE) != node) {
+            goto retry;
+        }
+
+        if (isMarked(next)) {
+            // Help finish a delete: unlink the node, and whoever succeeds retires it
+            KeyValuePair* expected = node;
+            if (!__atomic_compare_exchange_n(*previous, &expected, unmarkPointer(next), false,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                goto retry;
+            }
+            epochRetire(sot->epoch, node, splitFreeNode, NULL);
+            *current = unmarkPointer(next);
+            continue;
+        }
+
+        if (node->hash > sortKey) {
+            return false;  // Past where the key would be
+        }
+        if (node->hash == sortKey) {
+            // Distinct keys can share a sort key, so compare the keys themselves
+            if (key == NULL ? node->key == NULL : node->key != NULL && pairMatches(node, key, length, sortKey)) {
+                return true;
+            }
+        }
+        *previous = &node->next;
+        *current = next;
+    }
+}
+
+static KeyValuePair* splitGetBucket(SplitOrderedTable* sot, unsigned long bucket);
+
+/**
+ * Create the dummy node of a bucket and publish it
+ * 
+ * The dummy is inserted into the list starting from the parent bucket
+ * (the bucket with the highest bit cleared), which is initialized first.
+ * If another thread wins the race, its dummy is used instead.
+ */
+static KeyValuePair* splitInitializeBucket(SplitOrderedTable* sot, unsigned long bucket) {
+    unsigned long parent = bucket & ~(1UL << (63 - __builtin_clzl(bucket)));
+    KeyValuePair* parentDummy = splitGetBucket(sot, parent);
+    if (parentDummy == NULL) {
+        return NULL;
+    }
+
+    uint64_t sortKey = dummyKey(bucket);
+    KeyValuePair* dummy = splitCreateNode(sortKey, NULL, 0, NULL);
+    if (dummy == NULL) {
+        return NULL;
+    }
+
+    KeyValuePair** previous;
+    KeyValuePair* current;
+    for (;;) {
+        if (splitFind(sot, parentDummy, sortKey, NULL, 0, &previous, &current)) {
+            splitFreeNode(dummy, NULL);  // Another thread already added it
+            dummy = current;
+            break;
+        }
+        dummy->next = current;
+        KeyValuePair* expected = current;
+        if (__atomic_compare_exchange_n(previous, &expected, dummy, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+    }
+
+    KeyValuePair** slot = &sot->segments[bucket / SPLIT_SEGMENT_SIZE][bucket % SPLIT_SEGMENT_SIZE];
+    __atomic_store_n(slot, dummy, __ATOMIC_RELEASE);
+    return dummy;
+}
+
+/**
+ * Get the dummy node of a bucket, initializing the bucket if needed
+ * 
+ * @return The dummy node, or NULL if memory ran out
+ */
+static KeyValuePair* splitGetBucket(SplitOrderedTable* sot, unsigned long bucket) {
+    KeyValuePair*** segment = &sot->segments[bucket / SPLIT_SEGMENT_SIZE];
+    KeyValuePair** buckets = __atomic_load_n(segment, __ATOMIC_ACQUIRE);
+    if (buckets == NULL) {
+        // Allocate the segment; if another thread installs one first, use that
+        KeyValuePair** fresh = (KeyValuePair**)calloc(SPLIT_SEGMENT_SIZE, sizeof(KeyValuePair*));
+        if (fresh == NULL) {
+            return NULL;
+        }
+        KeyValuePair** expected = NULL;
+        if (__atomic_compare_exchange_n(segment, &expected, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            buckets = fresh;
+        } else {
+            free(fresh);
+            buckets = expected;
+        }
+    }
+
+    KeyValuePair* dummy = __atomic_load_n(&buckets[bucket % SPLIT_SEGMENT_SIZE], __ATOMIC_ACQUIRE);
+    return dummy != NULL ? dummy : splitInitializeBucket(sot, bucket);
+}
+
+/**
+ * Create a new SplitOrderedTable
+ * 
+ * @return A pointer to the new table, or NULL if allocation fails
+ */
+SplitOrderedTable* createSplitOrderedTable(void) {
+    SplitOrderedTable* sot = (SplitOrderedTable*)calloc(1, sizeof(SplitOrderedTable));
+    if (sot == NULL) {
+        return NULL;
+    }
+    sot->epoch = createEpochDomain();
+    sot->segments[0] = (KeyValuePair**)calloc(SPLIT_SEGMENT_SIZE, sizeof(KeyValuePair*));
+    sot->head = splitCreateNode(dummyKey(0), NULL, 0, NULL);
+    if (sot->epoch == NULL || sot->segments[0] == NULL || sot->head == NULL) {
+        freeEpochDomain(sot->epoch);
+        free(sot->segments[0]);
+        free(sot->head);
+        free(sot);
+        return NULL;
+    }
+    sot->segments[0][0] = sot->head;
+    sot->bucketCount = SPLIT_INITIAL_BUCKETS;
+    return sot;
+}
+
+/**
+ * Insert a key-value pair with a key of known length
+ * 
+ * If the key already exists, its value is updated. Otherwise the node is
+ * linked in with a single CAS, and the bucket count is doubled (one more
+ * CAS) once the average run length exceeds SPLIT_MAX_LOAD_FACTOR.
+ * 
+ * @param sot The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool splitOrderedInsertBytes(SplitOrderedTable* sot, const void* key, size_t length, void* value) {
+    uint64_t hashValue = hashWy(key, length);
+    uint64_t sortKey = regularKey(hashValue);
+    KeyValuePair* node = NULL;
+    bool inserted = false;
+    bool updated = false;
+
+    long* token = epochEnter(sot->epoch);
+    unsigned long bucketCount = __atomic_load_n(&sot->bucketCount, __ATOMIC_ACQUIRE);
+    KeyValuePair* start = splitGetBucket(sot, hashValue & (bucketCount - 1));
+    KeyValuePair** previous;
+    KeyValuePair* current;
+
+    while (start != NULL) {
+        if (splitFind(sot, start, sortKey, key, length, &previous, &current)) {
+            __atomic_store_n(&current->value, value, __ATOMIC_RELEASE);
+            updated = true;
+            break;
+        }
+        if (node == NULL) {
+            node = splitCreateNode(sortKey, key, length, value);
+            if (node == NULL) {
+                break;
+            }
+        }
+        node->next = current;
+        KeyValuePair* expected = current;
+        if (__atomic_compare_exchange_n(previous, &expected, node, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            inserted = true;
+            break;
+        }
+    }
+    epochExit(sot->epoch, token);
+
+    if (!inserted && node != NULL) {
+        splitFreeNode(node, NULL);  // The key turned out to exist after all
+    }
+    if (inserted) {
+        unsigned long size = __atomic_add_fetch(&sot->size, 1, __ATOMIC_RELAXED);
+        if (size > bucketCount * SPLIT_MAX_LOAD_FACTOR &&
+            bucketCount * 2 <= (unsigned long)SPLIT_SEGMENT_SIZE * SPLIT_MAX_SEGMENTS) {
+            // Losing this race just means another thread doubled it already
+            __atomic_compare_exchange_n(&sot->bucketCount, &bucketCount, bucketCount * 2, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        }
+    }
+    return inserted || updated;
+}
+
+/**
+ * Insert a key-value pair into the split-ordered table
+ * 
+ * @param sot The table
+ * @param key The key string
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool splitOrderedInsert(SplitOrderedTable* sot, const char* key, void* value) {
+    return splitOrderedInsertBytes(sot, key, strlen(key), value);
+}
+
+/**
+ * Retrieve a value by a key of known length
+ * 
+ * Never blocks and never writes to shared memory, apart from helping to
+ * unlink and retire nodes that concurrent deletes have already marked.
+ * 
+ * @param sot The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return The value associated with the key, or NULL if not found
+ */
+void* splitOrderedGetBytes(SplitOrderedTable* sot, const void* key, size_t length) {
+    uint64_t hashValue = hashWy(key, length);
+    void* value = NULL;
+
+    long* token = epochEnter(sot->epoch);
+    unsigned long bucketCount = __atomic_load_n(&sot->bucketCount, __ATOMIC_ACQUIRE);
+    KeyValuePair* start = splitGetBucket(sot, hashValue & (bucketCount - 1));
+    KeyValuePair** previous;
+    KeyValuePair* current;
+    if (start != NULL && splitFind(sot, start, regularKey(hashValue), key, length, &previous, &current)) {
+        value = __atomic_load_n(&current->value, __ATOMIC_ACQUIRE);
+    }
+    epochExit(sot->epoch, token);
+    return value;
+}
+
+/**
+ * Retrieve a value by key from the split-ordered table
+ * 
+ * @param sot The table
+ * @param key The key string
+ * @return The value associated with the key, or NULL if not found
+ */
+void* splitOrderedGet(SplitOrderedTable* sot, const char* key) {
+    return splitOrderedGetBytes(sot, key, strlen(key));
+}
+
+/**
+ * Delete a key of known length
+ * 
+ * The node is marked first (the linearization point, so exactly one of
+ * several racing deletes succeeds) and then unlinked; if the unlink CAS
+ * loses a race, a search cleans the node up instead.
+ * 
+ * @param sot The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return true if the key was found and deleted, false otherwise
+ */
+bool splitOrderedDeleteBytes(SplitOrderedTable* sot, const void* key, size_t length) {
+    uint64_t hashValue = hashWy(key, length);
+    uint64_t sortKey = regularKey(hashValue);
+    bool deleted = false;
+
+    long* token = epochEnter(sot->epoch);
+    unsigned long bucketCount = __atomic_load_n(&sot->bucketCount, __ATOMIC_ACQUIRE);
+    KeyValuePair* start = splitGetBucket(sot, hashValue & (bucketCount - 1));
+    KeyValuePair** previous;
+    KeyValuePair* current;
+
+    while (start != NULL && splitFind(sot, start, sortKey, key, length, &previous, &current)) {
+        KeyValuePair* next = __atomic_load_n(&current->next, __ATOMIC_ACQUIRE);
+        if (isMarked(next)) {
+            continue;  // Someone else is deleting it; search again
+        }
+        if (!__atomic_compare_exchange_n(&current->next, &next, markPointer(next), false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        deleted = true;
+        KeyValuePair* expected = current;
+        if (__atomic_compare_exchange_n(previous, &expected, next, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            epochRetire(sot->epoch, current, splitFreeNode, NULL);
+        } else {
+            splitFind(sot, start, sortKey, key, length, &previous, &current);
+        }
+        break;
+    }
+    epochExit(sot->epoch, token);
+
+    if (deleted) {
+        __atomic_sub_fetch(&sot->size, 1, __ATOMIC_RELAXED);
+    }
+    return deleted;
+}
+
+/**
+ * Delete a key-value pair from the split-ordered table
+ * 
+ * @param sot The table
+ * @param key The key string
+ * @return true if the key was found and deleted, false otherwise
+ */
+bool splitOrderedDelete(SplitOrderedTable* sot, const char* key) {
+    return splitOrderedDeleteBytes(sot, key, strlen(key));
+}
+
+/**
+ * Get the number of entries in the split-ordered table
+ */
+size_t splitOrderedSize(SplitOrderedTable* sot) {
+    return __atomic_load_n(&sot->size, __ATOMIC_RELAXED);
+}
+
+/**
+ * Free the split-ordered table
+ * 
+ * The caller must ensure no other thread is still using the table.
+ * 
+ * @param sot The table to free
+ */
+void freeSplitOrderedTable(SplitOrderedTable* sot) {
+    if (sot == NULL) {
+        return;
+    }
+    freeEpochDomain(sot->epoch);  // Reclaims everything already unlinked
+
+    // Every remaining node, dummies included, is still on the list
+    KeyValuePair* node = sot->head;
+    while (node != NULL) {
+        KeyValuePair* next = unmarkPointer(node->next);
+        splitFreeNode(node, NULL);
+        node = next;
+    }
+    for (int i = 0; i < SPLIT_MAX_SEGMENTS; i++) {
+        free(sot->segments[i]);
+    }
+    free(sot);
+}
+
+/**
+ * Concurrent Front-End: Sharded HashTable
+ * 
+ * A cheaper alternative to lock striping: N completely independent
+ * HashTables, each behind its own mutex. A key is routed to a shard by the
+ * top bits of its hash, while each shard indexes its buckets with the low
+ * bits (mask mode), so the two choices never correlate and every shard
+ * sees an even spread of keys.
+ * 
+ * Since the shards share nothing, each one allocates on its own (with a
+ * node pool of its own if asked for), grows and shrinks on its own schedule, and only ever blocks the threads that
+ * use the same shard: a resize stalls 1/N of the key space instead of the
+ * whole table. The price is a size and statistics that are only exact
+ * while no one is writing.
+ */
+#define DEFAULT_SHARDS 16
+
+/**
+ * Shard Structure
+ * 
+ * One shard on its own cache line, so that the locks of neighbouring
+ * shards do not share a line.
+ */
+typedef struct Shard {
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t lock; // Serializes every access to the table
+    HashTable* table;   // The shard's entries
+} Shard;
+
+/**
+ * ShardedHashTable Structure
+ */
+typedef struct ShardedHashTable {
+    Shard* shards;      // The shards
+    int shardCount;     // The number of shards (a power of two)
+    int shardBits;      // log2(shardCount): the number of top hash bits used for routing
+    HashFunction hashFunction; // Routes keys and is shared by every shard (hashWy by default)
+} ShardedHashTable;
+
+/**
+ * Create a new ShardedHashTable
+ * 
+ * Shards allocate their nodes with malloc unless pooled is set. A node
+ * pool (see enableNodePool) is faster but never gives back the space of
+ * deleted keys, so it only suits tables that mostly grow.
+ * 
+ * @param capacity The initial number of buckets across all shards
+ * @param shardCount The number of shards (rounded up to a power of two), or 0 for the default
+ * @param pooled Whether each shard allocates from a node pool of its own
+ * @return A pointer to the new table, or NULL if allocation fails
+ */
+ShardedHashTable* createShardedHashTable(int capacity, int shardCount, bool pooled) {
+    if (shardCount <= 0) {
+        shardCount = DEFAULT_SHARDS;
+    }
+    int shards = 1;
+    int bits = 0;
+    while (shards < shardCount && shards < MAX_POWER_OF_TWO_CAPACITY) {
+        shards *= 2;
+        bits++;
+    }
+
+    ShardedHashTable* sht = (ShardedHashTable*)malloc(sizeof(ShardedHashTable));
+    if (sht == NULL) {
+        return NULL;
+    }
+    sht->shards = (Shard*)aligned_alloc(CACHE_LINE_SIZE, shards * sizeof(Shard));
+    if (sht->shards == NULL) {
+        free(sht);
+        return NULL;
+    }
+    sht->shardCount = shards;
+    sht->shardBits = bits;
+    sht->hashFunction = hashWy;
+
+    int shardCapacity = capacity / shards > 0 ? capacity / shards : 1;
+    for (int i = 0; i < shards; i++) {
+        HashTable* table = createHashTable(shardCapacity);
+        if (table == NULL || !setIndexMode(table, INDEX_MASK) || (pooled && !enableNodePool(table))) {
+            freeHashTable(table);
+            for (int j = 0; j < i; j++) {
+                pthread_mutex_destroy(&sht->shards[j].lock);
+                freeHashTable(sht->shards[j].table);
+            }
+            free(sht->shards);
+            free(sht);
+            return NULL;
+        }
+        table->hashFunction = sht->hashFunction;
+        table->shard = true;
+        pthread_mutex_init(&sht->shards[i].lock, NULL);
+        sht->shards[i].table = table;
+    }
+    return sht;
+}
+
+/**
+ * Select the hash function of a sharded table
+ * 
+ * The hash picks a key's shard as well as its bucket, so changing the
+ * function would move keys between shards; it can only be changed while
+ * the table is empty, and no other thread may be using it.
+ * 
+ * @param sht The table
+ * @param hashFunction The new hash function, e.g. hashWy or hashDjb2
+ * @return true if the function was changed, false if the table is not empty
+ */
+bool setShardedHashFunction(ShardedHashTable* sht, HashFunction hashFunction) {
+    if (hashFunction == NULL) {
+        return false;
+    }
+    for (int i = 0; i < sht->shardCount; i++) {
+        if (sht->shards[i].table->size > 0) {
+            return false;
+        }
+    }
+    sht->hashFunction = hashFunction;
+    for (int i = 0; i < sht->shardCount; i++) {
+        sht->shards[i].table->hashFunction = hashFunction;  // Empty: nothing to rehash
+    }
+    return true;
+}
+
+// The shard a hash routes to: its top bits, which the shard's mask indexing never uses
+static inline Shard* shardFor(ShardedHashTable* sht, uint64_t hashValue) {
+    return &sht->shards[sht->shardBits > 0 ? hashValue >> (64 - sht->shardBits) : 0];
+}
+
+/**
+ * Insert a key-value pair with a key of known length
+ * 
+ * The key is hashed once; the same hash picks the shard and is stored in
+ * the shard's node.
+ * 
+ * @param sht The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool shardedInsertBytes(ShardedHashTable* sht, const void* key, size_t length, void* value) {
+    uint64_t hashValue = sht->hashFunction(key, length);
+    Shard* shard = shardFor(sht, hashValue);
+
+    pthread_mutex_lock(&shard->lock);
+    bool result = insertHashed(shard->table, key, length, hashValue, value);
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+/**
+ * Insert a key-value pair into the sharded table
+ * 
+ * @param sht The table
+ * @param key The key string
+ * @param value Pointer to the value to store
+ * @return true if insertion was successful, false otherwise
+ */
+bool shardedInsert(ShardedHashTable* sht, const char* key, void* value) {
+    return shardedInsertBytes(sht, key, strlen(key), value);
+}
+
+/**
+ * Retrieve a value by a key of known length
+ * 
+ * @param sht The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return The value associated with the key, or NULL if key not found
+ */
+void* shardedGetBytes(ShardedHashTable* sht, const void* key, size_t length) {
+    uint64_t hashValue = sht->hashFunction(key, length);
+    Shard* shard = shardFor(sht, hashValue);
+
+    // Lookups lock too: a get() may move an incremental rehash along
+    pthread_mutex_lock(&shard->lock);
+    void* value = getHashed(shard->table, key, length, hashValue);
+    pthread_mutex_unlock(&shard->lock);
+    return value;
+}
+
+/**
+ * Retrieve a value by key from the sharded table
+ * 
+ * @param sht The table
+ * @param key The key string
+ * @return The value associated with the key, or NULL if key not found
+ */
+void* shardedGet(ShardedHashTable* sht, const char* key) {
+    return shardedGetBytes(sht, key, strlen(key));
+}
+
+/**
+ * Delete a key of known length
+ * 
+ * @param sht The table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @return true if key was found and deleted, false if key not found
+ */
+bool shardedDeleteBytes(ShardedHashTable* sht, const void* key, size_t length) {
+    uint64_t hashValue = sht->hashFunction(key, length);
+    Shard* shard = shardFor(sht, hashValue);
+
+    pthread_mutex_lock(&shard->lock);
+    bool result = deleteHashed(shard->table, key, length, hashValue);
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+/**
+ * Delete a key-value pair from the sharded table
+ * 
+ * @param sht The table
+ * @param key The key string
+ * @return true if key was found and deleted, false if key not found
+ */
+bool shardedDelete(ShardedHashTable* sht, const char* key) {
+    return shardedDeleteBytes(sht, key, strlen(key));
+}
+
+/**
+ * Get the number of elements across all shards
+ * 
+ * Locks one shard at a time, so the result is only a snapshot while other
+ * threads are inserting or deleting.
+ * 
+ * @param sht The table
+ * @return The number of elements
+ */
+long shardedSize(ShardedHashTable* sht) {
+    long size = 0;
+    for (int i = 0; i < sht->shardCount; i++) {
+        pthread_mutex_lock(&sht->shards[i].lock);
+        size += sht->shards[i].table->size;
+        pthread_mutex_unlock(&sht->shards[i].lock);
+    }
+    return size;
+}
+
+/**
+ * Collect the chain-length statistics of one shard
+ * 
+ * Comparing the shards' sizes and chain lengths shows whether the keys,
+ * and with them the lock traffic, are spread evenly.
+ * 
+ * @param sht The table
+ * @param shard The shard index, from 0 to shardCount - 1
+ * @param stats Filled in as by getHashTableStats()
+ * @return true if the statistics were collected, false if shard is out of range
+ */
+bool getShardStats(ShardedHashTable* sht, int shard, HashTableStats* stats) {
+    if (shard < 0 || shard >= sht->shardCount) {
+        return false;
+    }
+    pthread_mutex_lock(&sht->shards[shard].lock);
+    getHashTableStats(sht->shards[shard].table, stats);
+    pthread_mutex_unlock(&sht->shards[shard].lock);
+    return true;
+}
+
+/**
+ * Free all memory used by a ShardedHashTable
+ * 
+ * No other thread may be using the table.
+ * 
+ * @param sht The table to free
+ */
+void freeShardedHashTable(ShardedHashTable* sht) {
+    if (sht == NULL) return;
+
+    for (int i = 0; i < sht->shardCount; i++) {
+        pthread_mutex_destroy(&sht->shards[i].lock);
+        freeHashTable(sht->shards[i].table);
+    }
+    free(sht->shards);
+    free(sht);
+}
+
+/**
+ * Persistence: Memory-Mapped Table Files
+ * 
+ * A read-only image of a HashTable that can be mmap'd and queried in
+ * place, so a restart does not have to insert every entry again: opening
+ * the file costs one mmap() regardless of its size, and the pages are
+ * read in on demand and shared through the page cache by every process
+ * that maps the same file.
+ * 
+ * Nothing in the file is a pointer. After a fixed header come the keys
+ * and values in one contiguous blob, then the bucket array, then the
+ * entries; everything refers to everything else by its offset from the
+ * start of the file. The entries are stored grouped by bucket, and bucket
+ * i covers entries buckets[i] to buckets[i + 1] - 1, so a lookup reads
+ * two offsets, scans a short run of fixed-size entries comparing hashes,
+ * and compares the key bytes of the candidates that match.
+ * 
+ * The hash function is recorded by id, so only the built-in ones can be
+ * used. The file is in the native byte order and is only meant to be read
+ * on the kind of machine that wrote it.
+ */
+#include <fcntl.h>      // For open
+#include <sys/mman.h>   // For mmap and munmap
+#include <sys/stat.h>   // For fstat (the size of the file to map)
+#include <unistd.h>     // For close, fsync and unlink
+
+#define MAPPED_MAGIC "CHTMAP\0\0"       // The first 8 bytes of every table file
+#define MAPPED_VERSION 1
+#define MAPPED_HEADER_BYTES 64          // The header, padded so the blob starts on a cache line
+#define MAPPED_HASH_WY 1                // Ids of the hash functions a file can be built with
+#define MAPPED_HASH_DJB2 2
+
+/**
+ * MappedHeader Structure
+ * 
+ * The start of a table file.
+ */
+typedef struct MappedHeader {
+    char magic[8];              // MAPPED_MAGIC
+    uint32_t version;           // MAPPED_VERSION
+    uint32_t hashId;            // MAPPED_HASH_WY or MAPPED_HASH_DJB2
+    uint64_t bucketCount;       // The number of buckets (a power of two)
+    uint64_t entryCount;        // The number of entries
+    uint64_t bucketsOffset;     // Where the bucketCount + 1 run starts are
+    uint64_t entriesOffset;     // Where the entries are
+    uint64_t fileSize;          // The size of the whole file
+} MappedHeader;
+
+/**
+ * MappedEntry Structure
+ * 
+ * One key-value pair of a table file. Keys are stored with a terminating
+ * NUL that keyLength does not count; values start on an 8-byte boundary.
+ */
+typedef struct MappedEntry {
+    uint64_t hash;              // The full hash of the key
+    uint64_t keyOffset;         // Where the key bytes are
+    uint64_t valueOffset;       // Where the value bytes are
+    uint32_t keyLength;         // The number of bytes in the key
+    uint32_t valueLength;       // The number of bytes in the value
+} MappedEntry;
+
+/**
+ * MappedHashTable Structure
+ * 
+ * An open table file.
+ */
+typedef struct MappedHashTable {
+    const uint8_t* base;        // The start of the mapping
+    size_t size;                // The length of the mapping
+    const uint64_t* buckets;    // Where each bucket's run of entries starts
+    const MappedEntry* entries; // The entries, grouped by bucket
+    uint64_t mask;              // bucketCount - 1
+    uint64_t entryCount;        // The number of entries
+    HashFunction hashFunction;  // The function the file was built with
+} MappedHashTable;
+
+/**
+ * Turns a value into the bytes stored for it in a table file
+ * 
+ * @param value The value held by the table
+ * @param length Set to the number of bytes to store
+ * @param context The context passed to saveMappedHashTable()
+ * @return The bytes to store (only read until the next call)
+ */
+typedef const void* (*ValueEncoder)(void* value, size_t* length, void* context);
+
+// The id a table file records for a hash function (0 if it has none)
+static uint32_t mappedHashId(HashFunction hashFunction) {
+    if (hashFunction == hashWy) return MAPPED_HASH_WY;
+    if (hashFunction == hashDjb2) return MAPPED_HASH_DJB2;
+    return 0;
+}
+
+/**
+ * Make a rename into a file's directory durable
+ * 
+ * rename() only changes the directory entry, which reaches the disk with
+ * the directory, not with the file: until the directory is synced, a
+ * crash can bring back the old name.
+ * 
+ * @param path The file that was renamed into place
+ * @return true if its directory was synced
+ */
+static bool syncParentDirectory(const char* path) {
+    const char* slash = strrchr(path, '/');
+    char* directory = slash == NULL ? strdup(".") : strndup(path, slash == path ? 1 : (size_t)(slash - path));
+    if (directory == NULL) {
+        return false;
+    }
+    int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(directory);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// Write bytes followed by zeros up to the next multiple of 8, advancing offset
+static bool writePadded(FILE* file, const void* data, size_t length, uint64_t* offset) {
+    static const char zeros[8] = {0};
+    size_t padding = (8 - length % 8) % 8;
+    if (fwrite(data, 1, length, file) != length || fwrite(zeros, 1, padding, file) != padding) {
+        return false;
+    }
+    *offset += length + padding;
+    return true;
+}
+
+/**
+ * Write a table's entries to a file that openMappedHashTable() can map
+ * 
+ * The file is written next to path and renamed over it once it is
+ * complete and synced, so readers see either the old file or the new one;
+ * the directory is synced after the rename, so a successful save also
+ * survives a crash.
+ * Expired entries are left out, and expiry times are not stored. Without
+ * an encoder the values are taken to be NUL-terminated strings (NULL
+ * values are stored as empty).
+ * 
+ * @param ht The hash table
+ * @param path The file to create or replace
+ * @param encode Turns each value into the bytes to store (NULL for strings)
+ * @param context Passed through to encode
+ * @return true on success, false on an I/O or allocation error or an unsupported hash function
+ */
+bool saveMappedHashTable(HashTable* ht, const char* path, ValueEncoder encode, void* context) {
+    uint32_t hashId = mappedHashId(ht->hashFunction);
+    if (hashId == 0) {
+        return false;
+    }
+
+    // Count the live entries of each bucket
+    uint64_t now = expiryNow(ht);
+    uint64_t bucketCount = 1;
+    while (bucketCount < (uint64_t)ht->size) {
+        bucketCount *= 2;
+    }
+    uint64_t mask = bucketCount - 1;
+    uint64_t* buckets = (uint64_t*)calloc(bucketCount + 1, sizeof(uint64_t));
+    MappedEntry* entries = (MappedEntry*)malloc((ht->size > 0 ? ht->size : 1) * sizeof(MappedEntry));
+    char* tempPath = (char*)malloc(strlen(path) + 5);
+    FILE* file = NULL;
+    if (buckets == NULL || entries == NULL || tempPath == NULL) {
+        goto fail;
+    }
+    HashTableIterator it;
+    initHashTableIterator(&it, ht);
+    uint64_t entryCount = 0;
+    for (KeyValuePair* pair; (pair = nextLivePair(&it, now)) != NULL; entryCount++) {
+        buckets[(pair->hash & mask) + 1]++;
+    }
+    // Turn the counts into run starts; buckets[i + 1] then serves as bucket i's fill cursor
+    for (uint64_t i = 1; i <= bucketCount; i++) {
+        buckets[i] += buckets[i - 1];
+    }
+    uint64_t* fill = (uint64_t*)malloc(bucketCount * sizeof(uint64_t));
+    if (fill == NULL) {
+        goto fail;
+    }
+    memcpy(fill, buckets, bucketCount * sizeof(uint64_t));
+
+    strcpy(tempPath, path);
+    strcat(tempPath, ".tmp");
+    file = fopen(tempPath, "wb");
+    if (file == NULL) {
+        free(fill);
+        goto fail;
+    }
+
+    // Stream the keys and values into the blob, placing each entry in its bucket's run
+    MappedHeader header;
+    memset(&header, 0, sizeof(header));
+    uint64_t offset = 0;
+    bool ok = writePadded(file, &header, sizeof(header), &offset);
+    while (ok && offset < MAPPED_HEADER_BYTES) {
+        uint64_t zero = 0;
+        ok = writePadded(file, &zero, sizeof(zero), &offset);
+    }
+    initHashTableIterator(&it, ht);
+    for (KeyValuePair* pair; ok && (pair = nextLivePair(&it, now)) != NULL;) {
+        size_t valueLength = 0;
+        const void* valueBytes = "";
+        if (encode != NULL) {
+            valueBytes = encode(pair->value, &valueLength, context);
+        } else if (pair->value != NULL) {
+            valueBytes = pair->value;
+            valueLength = strlen((const char*)valueBytes) + 1;
+        }
+        if (valueLength > UINT32_MAX || pair->keyLength > UINT32_MAX) {
+            ok = false;
+            break;
+        }
+
+        MappedEntry* entry = &entries[fill[pair->hash & mask]++];
+        entry->hash = pair->hash;
+        entry->keyLength = (uint32_t)pair->keyLength;
+        entry->keyOffset = offset;
+        ok = writePadded(file, pair->key, pair->keyLength + 1, &offset);
+        entry->valueLength = (uint32_t)valueLength;
+        entry->valueOffset = offset;
+        ok = ok && writePadded(file, valueBytes, valueLength, &offset);
+    }
+    free(fill);
+
+    // Then the bucket array and the entries, and finally the header
+    header.bucketsOffset = offset;
+    ok = ok && writePadded(file, buckets, (bucketCount + 1) * sizeof(uint64_t), &offset);
+    header.entriesOffset = offset;
+    ok = ok && writePadded(file, entries, entryCount * sizeof(MappedEntry), &offset);
+    memcpy(header.magic, MAPPED_MAGIC, sizeof(header.magic));
+    header.version = MAPPED_VERSION;
+    header.hashId = hashId;
+    header.bucketCount = bucketCount;
+    header.entryCount = entryCount;
+    header.fileSize = offset;
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // Make the file durable before it replaces the old one
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    file = NULL;
+    if (!ok || rename(tempPath, path) != 0) {
+        unlink(tempPath);
+        goto fail;
+    }
+    if (!syncParentDirectory(path)) {
+        goto fail;
+    }
+
+    free(tempPath);
+    free(entries);
+    free(buckets);
+    return true;
+
+fail:
+    if (file != NULL) {
+        fclose(file);
+        unlink(tempPath);
+    }
+    free(tempPath);
+    free(entries);
+    free(buckets);
+    return false;
+}
+
+/**
+ * Map a table file written by saveMappedHashTable()
+ * 
+ * Only the header is read and checked; the rest of the file is paged in by
+ * the lookups that need it. The file must not be modified while it is
+ * mapped (saveMappedHashTable() replaces it with a new file instead).
+ * 
+ * @param path The table file
+ * @return The open table, or NULL if the file cannot be mapped or is not a valid table file
+ */
+MappedHashTable* openMappedHashTable(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (uint64_t)info.st_size < MAPPED_HEADER_BYTES) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)info.st_size;
+    void* base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // The mapping keeps the file open
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    // Check that the header describes a file of exactly this size
+    const MappedHeader* header = (const MappedHeader*)base;
+    HashFunction hashFunction = header->hashId == MAPPED_HASH_WY ? hashWy
+                              : header->hashId == MAPPED_HASH_DJB2 ? hashDjb2 : NULL;
+    uint64_t bucketCount = header->bucketCount;
+    if (memcmp(header->magic, MAPPED_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != MAPPED_VERSION || hashFunction == NULL || header->fileSize != size ||
+        bucketCount == 0 || (bucketCount & (bucketCount - 1)) != 0 ||
+        header->bucketsOffset % 8 != 0 || header->entriesOffset % 8 != 0 ||
+        bucketCount >= size / sizeof(uint64_t) ||
+        header->bucketsOffset > size - (bucketCount + 1) * sizeof(uint64_t) ||
+        header->entryCount > size / sizeof(MappedEntry) ||
+        header->entriesOffset > size - header->entryCount * sizeof(MappedEntry)) {
+        munmap(base, size);
+        return NULL;
+    }
+
+    MappedHashTable* mt = (MappedHashTable*)malloc(sizeof(MappedHashTable));
+    if (mt == NULL) {
+        munmap(base, size);
+        return NULL;
+    }
+    mt->base = (const uint8_t*)base;
+    mt->size = size;
+    mt->buckets = (const uint64_t*)(mt->base + header->bucketsOffset);
+    mt->entries = (const MappedEntry*)(mt->base + header->entriesOffset);
+    mt->mask = bucketCount - 1;
+    mt->entryCount = header->entryCount;
+    mt->hashFunction = hashFunction;
+    return mt;
+}
+
+// Whether a range of bytes lies inside the mapping
+static inline bool mappedInBounds(const MappedHashTable* mt, uint64_t offset, uint64_t length) {
+    return offset <= mt->size && length <= mt->size - offset;
+}
+
+/**
+ * Look up a key of known length in a mapped table
+ * 
+ * The length-aware form of mappedGet().
+ * 
+ * @param mt The mapped table
+ * @param key The key bytes
+ * @param length The number of bytes in the key
+ * @param valueLength Set to the number of bytes in the value (may be NULL)
+ * @return The value bytes inside the mapping, or NULL if key not found
+ */
+const void* mappedGetBytes(const MappedHashTable* mt, const void* key, size_t length, size_t* valueLength) {
+    uint64_t hashValue = mt->hashFunction(key, length);
+    uint64_t bucket = hashValue & mt->mask;
+    uint64_t end = mt->buckets[bucket + 1];
+    if (end > mt->entryCount) {
+        return NULL;  // A damaged file: never read past the entries
+    }
+    for (uint64_t i = mt->buckets[bucket]; i < end; i++) {
+        const MappedEntry* entry = &mt->entries[i];
+        if (entry->hash != hashValue || entry->keyLength != length ||
+            !mappedInBounds(mt, entry->keyOffset, length) ||
+            !mappedInBounds(mt, entry->valueOffset, entry->valueLength)) {
+            continue;
+        }
+        if (memcmp(mt->base + entry->keyOffset, key, length) == 0) {
+            if (valueLength != NULL) {
+                *valueLength = entry->valueLength;
+            }
+            return mt->base + entry->valueOffset;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Look up a key in a mapped table
+ * 
+ * The counterpart of get() for a table opened with openMappedHashTable().
+ * The value stays valid until the table is closed.
+ * 
+ * @param mt The mapped table
+ * @param key The key to look up
+ * @param valueLength Set to the number of bytes in the value (may be NULL)
+ * @return The value bytes inside the mapping, or NULL if key not found
+ */
+const void* mappedGet(const MappedHashTable* mt, const char* key, size_t* valueLength) {
+    return mappedGetBytes(mt, key, strlen(key), valueLength);
+}
+
+/**
+ * Unmap a table file and free its handle
+ * 
+ * @param mt The mapped table to close
+ */
+void closeMappedHashTable(MappedHashTable* mt) {
+    if (mt == NULL) return;
+
+    munmap((void*)mt->base, mt->size);
+    free(mt);
+}
+
+/**
+ * Persistence: Background Snapshots
+ * 
+ * saveMappedHashTable() walks the whole table, so calling it directly
+ * stalls the caller for as long as the write takes. snapshotAsync() forks
+ * instead and lets the child write the file from its copy of the table
+ * while the parent goes on serving requests, the way Redis's BGSAVE does.
+ * Parent and child share every page copy-on-write: the child sees the
+ * table frozen at the moment of the fork, and a page is only duplicated
+ * when the parent writes to it before the child is done. That copying is
+ * the real cost of a snapshot, so it is reported along with the result.
+ */
+#include <errno.h>          // For errno and EINTR (interrupted waits)
+#include <sys/resource.h>   // For getrusage and struct rusage (page fault counts)
+#include <sys/wait.h>       // For wait4 and the exit status macros
+
+/**
+ * SnapshotJob Structure
+ * 
+ * A snapshot started by snapshotAsync(). The result fields are filled in
+ * by pollSnapshot() once the child has exited.
+ */
+typedef struct SnapshotJob {
+    pid_t pid;                  // The child writing the file (0 once it has been reaped)
+    uint64_t startMicros;       // When the child was forked
+    long parentFaultsAtFork;    // The parent's minor fault count at the fork
+    bool succeeded;             // Whether the file was written, renamed into place and made durable
+    double seconds;             // How long the child took
+    long parentMinorFaults;     // Minor faults the parent took meanwhile (copy-on-write copies, plus any new pages)
+    long childMinorFaults;      // Minor faults the child took
+} SnapshotJob;
+
+/**
+ * Start writing a table file in a forked child
+ * 
+ * The child writes the table as it was at the moment of the call, exactly
+ * as saveMappedHashTable() would, and exits; the table can be modified
+ * freely in the meantime. Call pollSnapshot() to find out when it is done.
+ * The child only reports success once the file and the rename (its
+ * directory) are synced, so a succeeded job survives a crash.
+ * 
+ * fork() only copies the calling thread, so no other thread may be in the
+ * middle of changing the table (or of a malloc() the encoder might need)
+ * when this is called. Only one snapshot may be writing to a path at a time.
+ * 
+ * @param ht The hash table
+ * @param path The file to create or replace
+ * @param encode Turns each value into the bytes to store (NULL for strings)
+ * @param context Passed through to encode
+ * @param job Filled in with the running snapshot
+ * @return true if the child was started, false if fork() failed
+ */
+bool snapshotAsync(HashTable* ht, const char* path, ValueEncoder encode, void* context, SnapshotJob* job) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    job->parentFaultsAtFork = usage.ru_minflt;
+    job->startMicros = monotonicMicros();
+    job->succeeded = false;
+    job->seconds = 0;
+    job->parentMinorFaults = 0;
+    job->childMinorFaults = 0;
+
+    fflush(NULL);  // Otherwise buffered output would be written by both processes
+    pid_t pid = fork();
+    if (pid < 0) {
+        job->pid = 0;
+        return false;
+    }
+    if (pid == 0) {
+        // The child: write the frozen image and leave without running atexit handlers
+        _exit(saveMappedHashTable(ht, path, encode, context) ? 0 : 1);
+    }
+    job->pid = pid;
+    return true;
+}
+
+/**
+ * Check whether a background snapshot has finished
+ * 
+ * Reaps the child once it has exited and fills in the job's results.
+ * 
+ * @param job The job started by snapshotAsync()
+ * @param block Whether to wait for the child instead of returning at once
+ * @return true once the snapshot has finished (successfully or not), false while it is still running
+ */
+bool pollSnapshot(SnapshotJob* job, bool block) {
+    if (job->pid == 0) {
+        return true;
+    }
+
+    int status;
+    struct rusage childUsage;
+    pid_t result;
+    do {
+        result = wait4(job->pid, &status, block ? 0 : WNOHANG, &childUsage);
+    } while (result < 0 && errno == EINTR);
+    if (result == 0) {
+        return false;  // Still writing
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    job->pid = 0;
+    job->seconds = (double)(monotonicMicros() - job->startMicros) / 1e6;
+    job->parentMinorFaults = usage.ru_minflt - job->parentFaultsAtFork;
+    if (result > 0) {
+        job->succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        job->childMinorFaults = childUsage.ru_minflt;
+    }
+    return true;
+}
+
+/**
+ * Persistence: Append-Only Journal
+ * 
+ * A table with a journal logs every change to a file opened with
+ * O_APPEND: a SET record each time a key's value is stored, an EXPIRE
+ * record each time its expiry time is set or cleared, and a DELETE record
+ * each time a key goes away (deleted, evicted or expired). findOrInsert()
+ * is refused on such a table, since writes through its slot would bypass
+ * the log. replayJournal() applies the records in order to rebuild the
+ * table after a restart.
+ * 
+ * Records are collected in memory and written in groups: one write() and
+ * one fdatasync() cover every change since the last group, which is
+ * flushed once it holds groupOps records or its oldest record is
+ * groupMicros old. A crash can therefore lose at most the last group, and
+ * a durable change costs a fraction of a system call. Since the age is
+ * only checked when a change is logged, an idle table should call
+ * flushJournal() from a timer.
+ * 
+ * Every record is length-prefixed and checksummed, so a record torn by a
+ * crash in the middle of a write() is detected on replay and cut off:
+ * 
+ *   uint32 length    The number of payload bytes
+ *   uint32 crc       CRC-32 of the payload
+ *   payload          uint8 op, uint32 key length, key, then for SET the
+ *                    value bytes and for EXPIRE a uint64 deadline
+ * 
+ * Integers are in the native byte order. A deadline is wall-clock time
+ * (CLOCK_REALTIME milliseconds, 0: never), since the expiry clock
+ * restarts with the process; an entry whose deadline passed while the
+ * process was down is dropped by the replay.
+ * 
+ * Since the log keeps every change ever made, rewriteJournalAsync()
+ * replaces it from time to time with one SET per live entry, so replay
+ * time follows the size of the table rather than its history.
+ */
+#define JOURNAL_SET 1                   // Record types
+#define JOURNAL_DELETE 2
+#define JOURNAL_EXPIRE 3
+#define JOURNAL_HEADER_BYTES 8          // length + crc
+#define JOURNAL_DEFAULT_GROUP_OPS 64    // Records per group commit
+#define JOURNAL_DEFAULT_GROUP_US 1000   // The longest a record waits for its group commit
+#define JOURNAL_REWRITE_CHUNK_BYTES (1 << 20) // Bytes a log rewrite writes at a time
+#define JOURNAL_RESYNC_BYTES (1 << 16)  // Bytes after a bad record searched for an intact one
+
+/**
+ * Journal Structure
+ * 
+ * The log of a table and the group of records not yet written to it.
+ */
+typedef struct Journal {
+    int fd;                     // The log, opened with O_APPEND
+    char* buffer;               // Records not yet written
+    size_t length;              // The number of bytes in buffer
+    size_t capacity;            // The size of buffer
+    int pending;                // The number of records in buffer
+    int groupOps;               // Records that trigger a group commit
+    uint64_t groupMicros;       // Age of the oldest record that triggers a group commit
+    uint64_t firstPendingMicros; // When the oldest record in buffer was logged
+    ValueEncoder encode;        // Turns values into bytes (NULL: NUL-terminated strings)
+    void* context;              // Passed through to encode
+    bool failed;                // Whether a record could not be logged or written
+    char* path;                 // The log file (renamed over by a rewrite)
+    pid_t rewritePid;           // The child writing a compact log (0: no rewrite running)
+    char* rewriteBuffer;        // Records logged since the rewrite started
+    size_t rewriteLength;       // The number of bytes in rewriteBuffer
+    size_t rewriteCapacity;     // The size of rewriteBuffer
+    bool rewriteFailed;         // Whether a record could not be kept for the rewritten log
+} Journal;
+
+/**
+ * Turns the bytes stored for a value back into a value
+ * 
+ * @param bytes The stored bytes (only valid during the call)
+ * @param length The number of bytes
+ * @param context The context passed to replayJournal()
+ * @return The value to store in the table
+ */
+typedef void* (*ValueDecoder)(const void* bytes, size_t length, void* context);
+
+static uint32_t crcTable[256];
+static pthread_once_t crcTableOnce = PTHREAD_ONCE_INIT;
+
+// Fill in the lookup table of the reflected CRC-32 polynomial 0xEDB88320
+static void crcTableInit(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+        crcTable[i] = crc;
+    }
+}
+
+/**
+ * Compute the CRC-32 (as used by zlib and Ethernet) of a run of bytes
+ */
+static uint32_t crc32(const void* data, size_t length) {
+    pthread_once(&crcTableOnce, crcTableInit);
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        crc = crcTable[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+ * Write a buffer to a file descriptor, retrying short and interrupted writes
+ */
+static bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+/**
+ * Write the pending group of records and make it durable
+ */
+static bool journalCommit(Journal* journal) {
+    if (journal->length > 0) {
+        if (!writeAll(journal->fd, journal->buffer, journal->length) || fdatasync(journal->fd) != 0) {
+            journal->failed = true;
+        }
+        journal->length = 0;
+        journal->pending = 0;
+    }
+    return !journal->failed;
+}
+
+/**
+ * Keep a copy of a record for the log being rewritten, which does not
+ * contain it yet
+ */
+static void rewriteKeep(Journal* journal, const char* record, size_t length) {
+    if (journal->rewriteFailed) {
+        return;
+    }
+    size_t needed = journal->rewriteLength + length;
+    if (needed > journal->rewriteCapacity) {
+        size_t capacity = journal->rewriteCapacity * 2 > needed ? journal->rewriteCapacity * 2 : needed;
+        char* buffer = (char*)realloc(journal->rewriteBuffer, capacity);
+        if (buffer == NULL) {
+            journal->rewriteFailed = true;  // The rewrite is abandoned; the old log stays complete
+            return;
+        }
+        journal->rewriteBuffer = buffer;
+        journal->rewriteCapacity = capacity;
+    }
+    memcpy(journal->rewriteBuffer + journal->rewriteLength, record, length);
+    journal->rewriteLength = needed;
+}
+
+/**
+ * Append one record to the pending group, committing the group when it
+ * is full or old enough
+ */
+static void journalAppend(Journal* journal, uint8_t op, const void* key, size_t keyLength,
+                          const void* value, size_t valueLength) {
+    size_t payload = 1 + sizeof(uint32_t) + keyLength + valueLength;
+    if (payload > UINT32_MAX) {
+        journal->failed = true;
+        return;
+    }
+    size_t needed = journal->length + JOURNAL_HEADER_BYTES + payload;
+    if (needed > journal->capacity) {
+        size_t capacity = journal->capacity * 2 > needed ? journal->capacity * 2 : needed;
+        char* buffer = (char*)realloc(journal->buffer, capacity);
+        if (buffer == NULL) {
+            journal->failed = true;
+            return;
+        }
+        journal->buffer = buffer;
+        journal->capacity = capacity;
+    }
+
+    char* record = journal->buffer + journal->length;
+    char* p = record + JOURNAL_HEADER_BYTES;
+    uint32_t keyLength32 = (uint32_t)keyLength;
+    *p++ = (char)op;
+    memcpy(p, &keyLength32, sizeof(keyLength32));
+    p += sizeof(keyLength32);
+    memcpy(p, key, keyLength);
+    p += keyLength;
+    if (valueLength > 0) {
+        memcpy(p, value, valueLength);
+    }
+    uint32_t length32 = (uint32_t)payload;
+    uint32_t crc = crc32(record + JOURNAL_HEADER_BYTES, payload);
+    memcpy(record, &length32, sizeof(length32));
+    memcpy(record + sizeof(length32), &crc, sizeof(crc));
+    journal->length = needed;
+    if (journal->rewritePid != 0) {
+        rewriteKeep(journal, record, JOURNAL_HEADER_BYTES + payload);
+    }
+
+    uint64_t now = monotonicMicros();
+    if (journal->pending++ == 0) {
+        journal->firstPendingMicros = now;
+    }
+    if (journal->pending >= journal->groupOps || now - journal->firstPendingMicros >= journal->groupMicros) {
+        journalCommit(journal);
+    }
+}
+
+/**
+ * Append a SET record holding a node's key and value
+ */
+static void journalAppendSet(Journal* journal, const KeyValuePair* pair) {
+    size_t valueLength = 0;
+    const void* valueBytes = NULL;
+    if (journal->encode != NULL) {
+        valueBytes = journal->encode(pair->value, &valueLength, journal->context);
+    } else if (pair->value != NULL) {
+        valueBytes = pair->value;
+        valueLength = strlen((const char*)valueBytes);
+    }
+    journalAppend(journal, JOURNAL_SET, pair->key, pair->keyLength, valueBytes, valueLength);
+}
+
+/**
+ * Log that a key's value was stored
+ */
+static void journalSet(HashTable* ht, const KeyValuePair* pair) {
+    journalAppendSet(ht->journal, pair);
+}
+
+/**
+ * Log that a key went away
+ */
+static void journalDelete(HashTable* ht, const KeyValuePair* pair) {
+    journalAppend(ht->journal, JOURNAL_DELETE, pair->key, pair->keyLength, NULL, 0);
+}
+
+// Milliseconds since the Unix epoch (the clock logged expiry deadlines use)
+static uint64_t wallClockMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/**
+ * Append an EXPIRE record holding a node's expiry time as a wall-clock
+ * deadline
+ */
+static void journalAppendExpire(Journal* journal, const HashTable* ht, const KeyValuePair* pair) {
+    uint64_t deadline = 0;
+    uint64_t expireAt = entryMeta(pair)->expireAt;
+    if (expireAt != 0) {
+        uint64_t now = ht->expiry->clock();
+        deadline = wallClockMs() + (expireAt > now ? expireAt - now : 0);
+    }
+    journalAppend(journal, JOURNAL_EXPIRE, pair->key, pair->keyLength, &deadline, sizeof(deadline));
+}
+
+/**
+ * Log that a key's expiry time was set or cleared
+ */
+static void journalExpire(HashTable* ht, const KeyValuePair* pair) {
+    journalAppendExpire(ht->journal, ht, pair);
+}
+
+// The file a log rewrite is written to before it replaces the log (malloc'd)
+static char* rewriteTempPath(const char* path) {
+    char* tempPath = (char*)malloc(strlen(path) + sizeof(".rewrite"));
+    if (tempPath != NULL) {
+        strcpy(tempPath, path);
+        strcat(tempPath, ".rewrite");
+    }
+    return tempPath;
+}
+
+/**
+ * Write a SET record for every live entry to a new log, in the child
+ * forked by rewriteJournalAsync(), and exit
+ */
+static _Noreturn void rewriteChild(HashTable* ht, const char* tempPath) {
+    Journal out;
+    memset(&out, 0, sizeof(out));
+    out.fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out.fd < 0) {
+        _exit(1);
+    }
+    out.groupOps = INT_MAX;           // Written in chunks below instead of in groups
+    out.groupMicros = UINT64_MAX;
+    out.encode = ht->journal->encode;
+    out.context = ht->journal->context;
+
+    HashTableIterator it;
+    initHashTableIterator(&it, ht);
+    uint64_t now = expiryNow(ht);
+    for (KeyValuePair* pair; !out.failed && (pair = nextLivePair(&it, now)) != NULL;) {
+        journalAppendSet(&out, pair);
+        if (ht->expiry != NULL && entryMeta(pair)->expireAt != 0) {
+            journalAppendExpire(&out, ht, pair);
+        }
+        if (out.length >= JOURNAL_REWRITE_CHUNK_BYTES) {
+            out.failed = !writeAll(out.fd, out.buffer, out.length);
+            out.length = 0;
+        }
+    }
+    bool ok = !out.failed && writeAll(out.fd, out.buffer, out.length) && fdatasync(out.fd) == 0;
+    _exit(ok && close(out.fd) == 0 ? 0 : 1);
+}
+
+/**
+ * Reap a log rewrite's child and, if it succeeded, switch to the new log
+ * 
+ * The records logged while the child was writing are appended to the new
+ * log, which then replaces the old one, and the directory is synced before
+ * any further record goes to the new log. Until the rename the old log is
+ * kept complete, so a crash at any point leaves a log with every change.
+ * If the directory cannot be synced, the journal is marked failed so that
+ * flushJournal() stops reporting changes as durable.
+ * 
+ * @param block Whether to wait for the child instead of returning at once
+ * @param succeeded Set to whether the log was replaced, once the rewrite is over (may be NULL)
+ * @return true once no rewrite is running, false while the child is still writing
+ */
+static bool finishRewrite(Journal* journal, bool block, bool* succeeded) {
+    if (journal->rewritePid == 0) {
+        return true;
+    }
+
+    int status;
+    pid_t result;
+    do {
+        result = waitpid(journal->rewritePid, &status, block ? 0 : WNOHANG);
+    } while (result < 0 && errno == EINTR);
+    if (result == 0) {
+        return false;  // Still writing
+    }
+    journal->rewritePid = 0;
+
+    bool ok = result > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 && !journal->rewriteFailed;
+    char* tempPath = rewriteTempPath(journal->path);
+    if (ok && tempPath != NULL) {
+        journalCommit(journal);
+        int fd = open(tempPath, O_WRONLY | O_APPEND | O_CLOEXEC);
+        ok = fd >= 0 && writeAll(fd, journal->rewriteBuffer, journal->rewriteLength) &&
+             fdatasync(fd) == 0 && rename(tempPath, journal->path) == 0;
+        // Until the directory is synced a crash can bring back the old log,
+        // which would lose every record committed to the new one
+        if (ok && !syncParentDirectory(journal->path)) {
+            journal->failed = true;
+        }
+        if (ok) {
+            close(journal->fd);
+            journal->fd = fd;
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    } else {
+        ok = false;
+    }
+    if (!ok && tempPath != NULL) {
+        unlink(tempPath);
+    }
+    free(tempPath);
+
+    free(journal->rewriteBuffer);
+    journal->rewriteBuffer = NULL;
+    journal->rewriteLength = 0;
+    journal->rewriteCapacity = 0;
+    journal->rewriteFailed = false;
+    if (succeeded != NULL) {
+        *succeeded = ok;
+    }
+    return true;
+}
+
+/**
+ * Commit the pending group and close a table's journal, if it has one
+ * 
+ * A rewrite that is still running is waited for and completed first.
+ */
+static void freeJournal(HashTable* ht) {
+    Journal* journal = ht->journal;
+    if (journal == NULL) {
+        return;
+    }
+    finishRewrite(journal, true, NULL);
+    journalCommit(journal);
+    close(journal->fd);
+    free(journal->buffer);
+    free(journal->path);
+    free(journal);
+    ht->journal = NULL;
+}
+
+/**
+ * Check for a complete, intact record at an offset of a log
+ * 
+ * @return The record's payload length, or 0 if the bytes there are not one
+ */
+static uint32_t journalRecordAt(const char* data, size_t size, size_t offset) {
+    uint32_t payload;
+    uint32_t crc;
+    uint32_t keyLength;
+    if (size - offset < JOURNAL_HEADER_BYTES) {
+        return 0;
+    }
+    memcpy(&payload, data + offset, sizeof(payload));
+    memcpy(&crc, data + offset + sizeof(payload), sizeof(crc));
+    const char* p = data + offset + JOURNAL_HEADER_BYTES;
+    if (payload > size - offset - JOURNAL_HEADER_BYTES || payload < 1 + sizeof(keyLength)) {
+        return 0;
+    }
+    memcpy(&keyLength, p + 1, sizeof(keyLength));
+    if (keyLength > payload - 1 - sizeof(keyLength) || crc32(p, payload) != crc) {
+        return 0;
+    }
+    return payload;
+}
+
+/**
+ * Check whether an intact record follows a bad one, which means the log
+ * is damaged rather than cut short by a crash
+ * 
+ * Two places are looked at: the boundary the bad record's own length
+ * names, if that lies inside the file, and every offset of the next
+ * JOURNAL_RESYNC_BYTES, for records that end inside that window. A
+ * corrupt length can thus cost one checksum over the rest of the file,
+ * never one per byte.
+ * 
+ * @return true if an intact record was found
+ */
+static bool journalRecordFollows(const char* data, size_t size, size_t offset) {
+    uint32_t payload;
+    if (size - offset >= JOURNAL_HEADER_BYTES) {
+        memcpy(&payload, data + offset, sizeof(payload));
+        size_t next = offset + JOURNAL_HEADER_BYTES + payload;
+        if (payload > 0 && next < size && journalRecordAt(data, size, next) != 0) {
+            return true;
+        }
+    }
+
+    size_t limit = size - offset > JOURNAL_RESYNC_BYTES ? offset + JOURNAL_RESYNC_BYTES : size;
+    for (size_t next = offset + 1; next < limit; next++) {
+        if (journalRecordAt(data, limit, next) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Start logging every change to a table
+ * 
+ * The log is opened for appending (and created if missing); to carry on
+ * an existing log, replay it into the table first. Entries already in
+ * the table are not logged.
+ * 
+ * Without an encoder the values are taken to be NUL-terminated strings
+ * (NULL values are logged as empty).
+ * 
+ * @param ht The hash table
+ * @param path The log file
+ * @param groupOps Records per group commit (0 for JOURNAL_DEFAULT_GROUP_OPS)
+ * @param groupMicros The longest a record may wait for its group commit (0 for JOURNAL_DEFAULT_GROUP_US)
+ * @param encode Turns each value into the bytes to log (NULL for strings)
+ * @param context Passed through to encode
+ * @return true on success, false if the log cannot be opened or the table already has one
+ */
+bool enableJournal(HashTable* ht, const char* path, int groupOps, uint64_t groupMicros,
+                   ValueEncoder encode, void* context) {
+    if (ht->journal != NULL) {
+        return false;
+    }
+    Journal* journal = (Journal*)calloc(1, sizeof(Journal));
+    if (journal == NULL) {
+        return false;
+    }
+    journal->path = strdup(path);
+    journal->fd = journal->path != NULL ? open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) : -1;
+    if (journal->fd < 0) {
+        free(journal->path);
+        free(journal);
+        return false;
+    }
+    journal->groupOps = groupOps > 0 ? groupOps : JOURNAL_DEFAULT_GROUP_OPS;
+    journal->groupMicros = groupMicros > 0 ? groupMicros : JOURNAL_DEFAULT_GROUP_US;
+    journal->encode = encode;
+    journal->context = context;
+    ht->journal = journal;
+    return true;
+}
+
+/**
+ * Write and sync the changes logged since the last group commit
+ * 
+ * Call it from a timer so the last changes before a quiet period do not
+ * wait for the next one, and before reporting a change as durable.
+ * 
+ * @param ht The hash table
+ * @return true if every change logged so far has been written, false after any failure
+ */
+bool flushJournal(HashTable* ht) {
+    return ht->journal == NULL || journalCommit(ht->journal);
+}
+
+/**
+ * Commit the last changes and stop logging
+ * 
+ * freeHashTable() does this too.
+ * 
+ * @param ht The hash table
+ * @return true if every change logged was written, false after any failure
+ */
+bool disableJournal(HashTable* ht) {
+    bool ok = flushJournal(ht);
+    freeJournal(ht);
+    return ok;
+}
+
+// The expiry clock during a replay: nothing is due at time 0
+static uint64_t replayClock(void) {
+    return 0;
+}
+
+/**
+ * Remove the entries a replay left with a deadline in the past, handing
+ * their values to discard
+ */
+static void replayDropExpired(HashTable* ht, EvictionCallback discard, void* context) {
+    uint64_t now = ht->expiry->clock();
+    for (int pass = 0; pass < 2; pass++) {
+        KeyValuePair** array = pass == 0 ? ht->array : ht->oldArray;
+        int start = pass == 0 ? 0 : ht->rehashIndex;
+        int capacity = pass == 0 ? ht->capacity : ht->oldCapacity;
+        for (int i = start; array != NULL && i < capacity; i++) {
+            KeyValuePair** link = &array[i];
+            while (*link != NULL) {
+                if (!isExpired(ht, *link, now)) {
+                    link = &(*link)->next;
+                    continue;
+                }
+                KeyValuePair* pair = unlinkPair(ht, link);
+                if (discard != NULL) {
+                    discard(pair->key, pair->keyLength, pair->value, context);
+                }
+                releasePair(ht, pair);
+            }
+        }
+    }
+    shrinkIfNeeded(ht);
+}
+
+/**
+ * Rebuild a table by applying the records of a journal
+ * 
+ * Records are applied in order until the end of the log or the first one
+ * that is incomplete or fails its checksum. If no intact record follows
+ * it (at the boundary its length names, or within JOURNAL_RESYNC_BYTES),
+ * it is the tail a crash cut short: the log is truncated there and new
+ * records follow the last good one. Otherwise the middle of the log is
+ * damaged; the file is left untouched for inspection and -1 is returned,
+ * with the records before the damage already applied.
+ * 
+ * Every SET stores a value made by decode; without a decoder the value is
+ * a malloc'd NUL-terminated copy of the logged bytes. Values a later
+ * record replaces or deletes are handed to discard so they can be freed,
+ * and so are those of entries whose logged expiry deadline has passed.
+ * Entries with a deadline still ahead expire that much later on the
+ * table's expiry clock.
+ * 
+ * @param ht The hash table (must not have a journal of its own yet)
+ * @param path The log file (a missing file counts as empty)
+ * @param decode Turns the logged bytes back into values (NULL for strings)
+ * @param discard Called with every value that is replaced or deleted (may be NULL)
+ * @param context Passed through to decode and discard
+ * @return The number of records applied, or -1 on an I/O or allocation error or a damaged log
+ */
+long replayJournal(HashTable* ht, const char* path, ValueDecoder decode, EvictionCallback discard, void* context) {
+    if (ht->journal != NULL) {
+        return -1;  // The replayed changes would be logged a second time
+    }
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)info.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    const char* data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    madvise((void*)data, size, MADV_SEQUENTIAL);
+
+    // Stop the expiry clock until every record is in: a deadline that has
+    // passed may still be lifted by a later record
+    ClockFunction clock = ht->expiry != NULL ? ht->expiry->clock : monotonicMs;
+    if (ht->expiry != NULL) {
+        ht->expiry->clock = replayClock;
+    }
+
+    long applied = 0;
+    size_t offset = 0;
+    bool failed = false;
+    while (!failed && offset < size) {
+        uint32_t payload = journalRecordAt(data, size, offset);
+        if (payload == 0) {
+            // Only the tail a crash cut short may be dropped: if an intact
+            // record follows, the log is damaged and is left as it is
+            failed = journalRecordFollows(data, size, offset);
+            break;
+        }
+        const char* p = data + offset + JOURNAL_HEADER_BYTES;
+        uint8_t op = (uint8_t)p[0];
+        uint32_t keyLength;
+        memcpy(&keyLength, p + 1, sizeof(keyLength));
+        const char* key = p + 1 + sizeof(keyLength);
+        const char* valueBytes = key + keyLength;
+        size_t valueLength = payload - 1 - sizeof(keyLength) - keyLength;
+        uint64_t hashValue = ht->hashFunction(key, keyLength);
+
+        if (op == JOURNAL_SET) {
+            void* value;
+            if (decode != NULL) {
+                value = decode(valueBytes, valueLength, context);
+            } else if ((value = malloc(valueLength + 1)) != NULL) {
+                memcpy(value, valueBytes, valueLength);
+                ((char*)value)[valueLength] = '\0';
+            } else {
+                failed = true;
+                break;
+            }
+            bool inserted;
+            KeyValuePair* pair = findOrInsertPair(ht, key, keyLength, hashValue, &inserted);
+            if (pair == NULL) {
+                if (decode == NULL) {
+                    free(value);
+                }
+                failed = true;
+                break;
+            }
+            if (!inserted && discard != NULL) {
+                discard(pair->key, pair->keyLength, pair->value, context);
+            }
+            storeValue(ht, pair, value);
+        } else if (op == JOURNAL_DELETE || op == JOURNAL_EXPIRE) {
+            uint64_t deadline = 0;
+            uint64_t wallNow = 0;
+            if (op == JOURNAL_EXPIRE) {
+                if (valueLength != sizeof(deadline)) {
+                    failed = true;
+                    break;
+                }
+                memcpy(&deadline, valueBytes, sizeof(deadline));
+                wallNow = wallClockMs();
+                // Before the lookup: giving the table expiry may move its nodes
+                if (deadline != 0 && ht->expiry == NULL) {
+                    if (ensureExpiry(ht) == NULL) {
+                        failed = true;
+                        break;
+                    }
+                    clock = ht->expiry->clock;
+                    ht->expiry->clock = replayClock;
+                }
+            }
+            rehashTick(ht);
+            KeyValuePair** link = findLink(ht, key, keyLength, hashValue);
+            if (link != NULL && op == JOURNAL_EXPIRE) {
+                // The time left carries over to this process's expiry clock; a
+                // deadline already past makes the entry due (1 is before any clock reading)
+                if (deadline != 0) {
+                    setPairExpiry(ht, *link, deadline > wallNow ? clock() + (deadline - wallNow) : 1);
+                } else if (ht->expiry != NULL) {
+                    setPairExpiry(ht, *link, 0);
+                }
+            } else if (link != NULL) {
+                KeyValuePair* pair = unlinkPair(ht, link);
+                if (discard != NULL) {
+                    discard(pair->key, pair->keyLength, pair->value, context);
+                }
+                releasePair(ht, pair);
+                shrinkIfNeeded(ht);
+            }
+        } else {
+            failed = true;  // An intact record of an unknown type: not a log this code can replay
+            break;
+        }
+        applied++;
+        offset += JOURNAL_HEADER_BYTES + payload;
+    }
+
+    munmap((void*)data, size);
+    if (ht->expiry != NULL) {
+        ht->expiry->clock = clock;
+        replayDropExpired(ht, discard, context);
+    }
+    if (!failed && offset < size && ftruncate(fd, (off_t)offset) != 0) {
+        failed = true;
+    }
+    close(fd);
+    return failed ? -1 : applied;
+}
+
+/**
+ * Start rewriting a table's journal as one record per live entry
+ * 
+ * Forks a child that writes a SET (and an EXPIRE, if it has an expiry
+ * time) for every entry of its copy-on-write image of the table to a new
+ * file next to the log, while the parent
+ * keeps serving and logging changes as usual. Changes logged from now on
+ * also go to a buffer; once the child is done, pollJournalRewrite()
+ * appends that buffer to the new file and renames it over the log.
+ * 
+ * As with snapshotAsync(), no other thread may be changing the table when
+ * this is called.
+ * 
+ * @param ht The hash table
+ * @return true if the rewrite was started, false if the table has no journal, a rewrite is already running, or fork() failed
+ */
+bool rewriteJournalAsync(HashTable* ht) {
+    Journal* journal = ht->journal;
+    if (journal == NULL || journal->rewritePid != 0) {
+        return false;
+    }
+    char* tempPath = rewriteTempPath(journal->path);
+    if (tempPath == NULL) {
+        return false;
+    }
+
+    fflush(NULL);  // Otherwise buffered output would be written by both processes
+    pid_t pid = fork();
+    if (pid < 0) {
+        free(tempPath);
+        return false;
+    }
+    if (pid == 0) {
+        rewriteChild(ht, tempPath);
+    }
+    free(tempPath);
+    journal->rewritePid = pid;
+    journal->rewriteLength = 0;
+    journal->rewriteFailed = false;
+    return true;
+}
+
+/**
+ * Check whether a journal rewrite has finished, completing it if so
+ * 
+ * Call it regularly while a rewrite is running: the changes logged in the
+ * meantime pile up in memory until it has been called. If the rewrite
+ * failed, the old log simply stays in use.
+ * 
+ * @param ht The hash table
+ * @param block Whether to wait for the child instead of returning at once
+ * @param succeeded Set to whether the log was replaced, once the rewrite is over (may be NULL)
+ * @return true once no rewrite is running, false while it is still in progress
+ */
+bool pollJournalRewrite(HashTable* ht, bool block, bool* succeeded) {
+    if (ht->journal == NULL) {
+        return true;
+    }
+    return finishRewrite(ht->journal, block, succeeded);
+}
+
+/**
+ * Example of hash table usage
+ */
+/*
+int main() {
+    // Create a hash table with 10 buckets
+    HashTable* ht = createHashTable(10);
+    
+    // Define some example values (normally these would be more complex data structures)
+    int value1 = 100;
+    int value2 = 200;
+    int value3 = 300;
+    
+    // Insert key-value pairs
+    insert(ht, "key1", &value1);
+    insert(ht, "key2", &value2);
+    insert(ht, "key3", &value3);
+    
+    // Print the hash table
+    printHashTable(ht);
+    
+    // Retrieve and print a value
+    int* retrieved = (int*)get(ht, "key2");
+    if (retrieved != NULL) {
+        printf("Value for key2: %d\n", *retrieved);
+    }
+    
+    // Delete a key
+    if (delete(ht, "key1")) {
+        printf("Deleted key1\n");
+    }
+    
+    // Print the hash table again to see the change
+    printHashTable(ht);
+    
+    // Free the hash table
+    freeHashTable(ht);
+    
+    return 0;
+}
+*/
+
+#ifdef HASH_TABLE_BENCHMARK
+/**
+ * Benchmarks
+ * 
+ * Build and run with:
+ *   gcc -O2 -pthread -DHASH_TABLE_BENCHMARK hash_table.c -o hash_table_bench
+ *   ./hash_table_bench [benchmark|all] [keys.txt]
+ * 
+ * keys.txt holds one key per line (e.g. a dump of production keys). Without
+ * it a synthetic corpus of short ids, hex tokens and long URL paths is used.
+ */
+#include <time.h>       // For clock_gettime
+#include <unistd.h>     // For sysconf (number of cores)
+
+#define BENCH_SYNTHETIC_KEYS 300000
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Load the key corpus from a file, or generate a synthetic one
+ * 
+ * @param path The file to read (one key per line), or NULL
+ * @param count Set to the number of keys loaded
+ * @return A malloc'd array of malloc'd keys
+ */
+static char** loadKeys(const char* path, int* count) {
+    int capacity = BENCH_SYNTHETIC_KEYS;
+    char** keys = (char**)malloc(capacity * sizeof(char*));
+    char line[4096];
+    *count = 0;
+
+    if (path != NULL) {
+        FILE* file = fopen(path, "r");
+        if (file == NULL) {
+            perror("fopen");
+            exit(1);
+        }
+        while (fgets(line, sizeof(line), file) != NULL) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (*count == capacity) {
+                capacity *= 2;
+                keys = (char**)realloc(keys, capacity * sizeof(char*));
+            }
+            keys[(*count)++] = strdup(line);
+        }
+        fclose(file);
+        return keys;
+    }
+
+    // A third each of short ids, 16-character hex tokens and long paths
+    for (int i = 0; i < BENCH_SYNTHETIC_KEYS; i++) {
+        switch (i % 3) {
+            case 0: snprintf(line, sizeof(line), "user:%d", i); break;
+            case 1: snprintf(line, sizeof(line), "%016llx", (unsigned long long)i * 2654435761ULL); break;
+            default: snprintf(line, sizeof(line), "/api/v1/customers/%d/orders/%d?expand=items,shipping", i / 7, i); break;
+        }
+        keys[(*count)++] = strdup(line);
+    }
+    return keys;
+}
+
+static void freeKeys(char** keys, int count) {
+    for (int i = 0; i < count; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+}
+
+/**
+ * Measure hashing throughput and chain-length distribution of one function
+ */
+static void benchmarkHashFunction(const char* name, HashFunction hashFunction, char** keys, int count) {
+    size_t* lengths = (size_t*)malloc(count * sizeof(size_t));
+    size_t totalBytes = 0;
+    for (int i = 0; i < count; i++) {
+        lengths[i] = strlen(keys[i]);
+        totalBytes += lengths[i];
+    }
+
+    // Throughput: hash the whole corpus several times
+    const int rounds = 20;
+    uint64_t sink = 0;
+    double start = nowSeconds();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            sink += hashFunction(keys[i], lengths[i]);
+        }
+    }
+    double elapsed = nowSeconds() - start;
+
+    // Distribution: a power-of-two bucket count keeps only the low bits
+    int capacity = 1;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    HashTable* ht = createHashTable(capacity);
+    setHashFunction(ht, hashFunction);
+    setLoadFactorThresholds(ht, 1e9, 0.0);  // Keep the bucket count fixed
+    for (int i = 0; i < count; i++) {
+        insert(ht, keys[i], NULL);
+    }
+    HashTableStats stats;
+    getHashTableStats(ht, &stats);
+    freeHashTable(ht);
+
+    printf("  %-8s %7.2f ns/key %8.1f MB/s | buckets used %6.2f%% mean chain %.3f max chain %d (sink %llx)\n",
+           name, elapsed * 1e9 / ((double)rounds * count), (double)rounds * totalBytes / elapsed / 1e6,
+           100.0 * stats.usedBuckets / stats.capacity, stats.meanChain, stats.maxChain,
+           (unsigned long long)(sink & 0xf));
+    free(lengths);
+}
+
+static void benchmarkHash(char** keys, int count) {
+    printf("Hash functions (%d keys):\n", count);
+    benchmarkHashFunction("djb2", hashDjb2, keys, count);
+    benchmarkHashFunction("wyhash", hashWy, keys, count);
+}
+
+/**
+ * Measure get() throughput for each index mode on a table larger than cache
+ */
+static void benchmarkIndexMode(const char* name, IndexMode mode, char** keys, int count) {
+    HashTable* ht = createHashTable(count);
+    setIndexMode(ht, mode);
+    for (int i = 0; i < count; i++) {
+        insert(ht, keys[i], keys[i]);
     }
-    
-    // Print the hash table again to see the change
-    printHashTable(ht);
-    
-    // Free the hash table
+
+    const int rounds = 10;
+    int found = 0;
+    double start = nowSeconds();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            found += get(ht, keys[i]) != NULL;
+        }
+    }
+    double elapsed = nowSeconds() - start;
+
+    printf("  %-10s capacity %8d %7.2f ns/get (found %d)\n",
+           name, ht->capacity, elapsed * 1e9 / ((double)rounds * count), found / rounds);
     freeHashTable(ht);
-    
-    return 0;
 }
-*/
\ No newline at end of file
+
+static void benchmarkIndex(char** keys, int count) {
+    printf("Index modes (%d keys):\n", count);
+    benchmarkIndexMode("modulo", INDEX_MODULO, keys, count);
+    benchmarkIndexMode("mask", INDEX_MASK, keys, count);
+    benchmarkIndexMode("fastrange", INDEX_FASTRANGE, keys, count);
+}
+
+/**
+ * get() one key at a time vs getBatch() in chunks of 1024 keys
+ * 
+ * The keys are looked up in a shuffled order, so consecutive lookups hit
+ * unrelated cache lines and the hardware prefetcher cannot help; on a
+ * table larger than the last-level cache every get() then waits for its
+ * misses in turn, while getBatch() overlaps them.
+ */
+static void benchmarkBatch(char** keys, int count) {
+    printf("Batched lookups (%d keys, shuffled):\n", count);
+    HashTable* ht = createHashTable(count);
+    for (int i = 0; i < count; i++) {
+        insert(ht, keys[i], keys[i]);
+    }
+
+    const char** order = (const char**)malloc(count * sizeof(char*));
+    void** values = (void**)malloc(count * sizeof(void*));
+    for (int i = 0; i < count; i++) {
+        order[i] = keys[i];
+    }
+    unsigned int seed = 12345u;
+    for (int i = count - 1; i > 0; i--) {
+        seed = seed * 1103515245u + 12345u;
+        int j = (int)((seed >> 8) % (unsigned int)(i + 1));
+        const char* swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+
+    const int rounds = 5;
+    const int chunk = 1024;
+    int found = 0;
+    double start = nowSeconds();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            found += get(ht, order[i]) != NULL;
+        }
+    }
+    double single = (nowSeconds() - start) * 1e9 / ((double)rounds * count);
+    printf("  get()      %7.2f ns/key (found %d)\n", single, found / rounds);
+
+    found = 0;
+    start = nowSeconds();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i += chunk) {
+            found += getBatch(ht, order + i, count - i < chunk ? count - i : chunk, values + i);
+        }
+    }
+    double batched = (nowSeconds() - start) * 1e9 / ((double)rounds * count);
+    printf("  getBatch() %7.2f ns/key (found %d) speedup %.2fx\n", batched, found / rounds, single / batched);
+
+    free(order);
+    free(values);
+    freeHashTable(ht);
+}
+
+/**
+ * Build "miss" keys that are guaranteed not to be in the corpus
+ */
+static char** makeMissKeys(char** keys, int count) {
+    char** misses = (char**)malloc(count * sizeof(char*));
+    for (int i = 0; i < count; i++) {
+        size_t length = strlen(keys[i]);
+        misses[i] = (char*)malloc(length + 2);
+        memcpy(misses[i], keys[i], length);
+        misses[i][length] = '\x01';  // Not present in any line-based corpus
+        misses[i][length + 1] = '\0';
+    }
+    return misses;
+}
+
+/**
+ * A/B comparison of the chained HashTable and the SwissTable engine
+ */
+static void benchmarkSwiss(char** keys, int count) {
+    char** misses = makeMissKeys(keys, count);
+    int found = 0;
+    printf("Chained vs SwissTable (%d keys, ns/op):\n", count);
+
+    HashTable* ht = createHashTable(16);
+    setIndexMode(ht, INDEX_MASK);
+    double t0 = nowSeconds();
+    for (int i = 0; i < count; i++) insert(ht, keys[i], keys[i]);
+    double t1 = nowSeconds();
+    for (int i = 0; i < count; i++) found += get(ht, keys[i]) != NULL;
+    double t2 = nowSeconds();
+    for (int i = 0; i < count; i++) found += get(ht, misses[i]) != NULL;
+    double t3 = nowSeconds();
+    for (int i = 0; i < count; i++) found -= delete(ht, keys[i]);
+    double t4 = nowSeconds();
+    freeHashTable(ht);
+    printf("  %-8s insert %7.2f  hit %7.2f  miss %7.2f  delete %7.2f\n", "chained",
+           (t1 - t0) * 1e9 / count, (t2 - t1) * 1e9 / count, (t3 - t2) * 1e9 / count, (t4 - t3) * 1e9 / count);
+
+    SwissTable* st = createSwissTable(16);
+    t0 = nowSeconds();
+    for (int i = 0; i < count; i++) swissInsert(st, keys[i], keys[i]);
+    t1 = nowSeconds();
+    for (int i = 0; i < count; i++) found += swissGet(st, keys[i]) != NULL;
+    t2 = nowSeconds();
+    for (int i = 0; i < count; i++) found += swissGet(st, misses[i]) != NULL;
+    t3 = nowSeconds();
+    for (int i = 0; i < count; i++) found -= swissDelete(st, keys[i]);
+    t4 = nowSeconds();
+    freeSwissTable(st);
+    printf("  %-8s insert %7.2f  hit %7.2f  miss %7.2f  delete %7.2f\n", "swiss",
+           (t1 - t0) * 1e9 / count, (t2 - t1) * 1e9 / count, (t3 - t2) * 1e9 / count, (t4 - t3) * 1e9 / count);
+
+    if (found != 0) {
+        printf("  unexpected result: %d\n", found);
+    }
+    freeKeys(misses, count);
+}
+
+/**
+ * Robin Hood table filled to 0.9 load: lookup cost and probe lengths
+ */
+static void benchmarkRobinHood(char** keys, int count) {
+    char** misses = makeMissKeys(keys, count);
+    int found = 0;
+
+    // The largest table the corpus can fill to 90% (without triggering growth)
+    RobinHoodTable* rt = createRobinHoodTable(0);
+    while (rt->capacity * 2 * 0.9 <= count) {
+        robinHoodResize(rt, rt->capacity * 2);
+    }
+    int fill = (int)(rt->capacity * 0.9);
+
+    double t0 = nowSeconds();
+    for (int i = 0; i < fill; i++) robinHoodInsert(rt, keys[i], keys[i]);
+    double t1 = nowSeconds();
+    for (int i = 0; i < fill; i++) found += robinHoodGet(rt, keys[i]) != NULL;
+    double t2 = nowSeconds();
+    for (int i = 0; i < fill; i++) found -= robinHoodGet(rt, misses[i]) != NULL;
+    double t3 = nowSeconds();
+
+    RobinHoodStats stats;
+    getRobinHoodStats(rt, &stats);
+    printf("Robin Hood (%zu entries, load %.3f, ns/op):\n", stats.size, (double)stats.size / stats.capacity);
+    printf("  insert %7.2f  hit %7.2f  miss %7.2f | probe length mean %.3f max %u (found %d)\n",
+           (t1 - t0) * 1e9 / fill, (t2 - t1) * 1e9 / fill, (t3 - t2) * 1e9 / fill,
+           stats.meanProbeLength, stats.maxProbeLength, found);
+
+    freeRobinHoodTable(rt);
+    freeKeys(misses, count);
+}
+
+/**
+ * Insert/delete/free cost with malloc'd nodes vs a node pool
+ */
+static void benchmarkPoolMode(const char* name, bool pooled, char** keys, int count) {
+    HashTable* ht = createHashTable(count);
+    if (pooled) {
+        enableNodePool(ht);
+    }
+
+    double t0 = nowSeconds();
+    for (int i = 0; i < count; i++) insert(ht, keys[i], keys[i]);
+    double t1 = nowSeconds();
+    for (int i = 0; i < count; i += 2) delete(ht, keys[i]);
+    for (int i = 0; i < count; i += 2) insert(ht, keys[i], keys[i]);
+    double t2 = nowSeconds();
+    freeHashTable(ht);
+    double t3 = nowSeconds();
+
+    printf("  %-8s insert %7.2f ns  delete+reinsert %7.2f ns  free %7.2f ms\n", name,
+           (t1 - t0) * 1e9 / count, (t2 - t1) * 1e9 / count, (t3 - t2) * 1e3);
+}
+
+static void benchmarkPool(char** keys, int count) {
+    printf("Node allocation (%d keys):\n", count);
+    benchmarkPoolMode("malloc", false, keys, count);
+    benchmarkPoolMode("pool", true, keys, count);
+}
+
+/**
+ * Time one way of filling an empty table with the whole corpus
+ * 
+ * @param mode 0 for a loop of insert(), 1 for bulkLoad(), 2 for bulkLoad() with assumeUnique,
+ *             3 for bulkLoad() with assumeUnique into a table with a node pool
+ */
+static void benchmarkBulkMode(const char* name, int mode, const HashTableEntry* entries, char** keys, int count) {
+    HashTable* ht = createHashTable(16);
+    if (mode == 3) {
+        enableNodePool(ht);
+    }
+    double start = nowSeconds();
+    if (mode == 0) {
+        for (int i = 0; i < count; i++) {
+            insert(ht, keys[i], keys[i]);
+        }
+    } else {
+        bulkLoad(ht, entries, count, mode >= 2);
+    }
+    double elapsed = nowSeconds() - start;
+
+    printf("  %-22s %7.2f ns/key (size %d, capacity %d)\n", name, elapsed * 1e9 / count, ht->size, ht->capacity);
+    freeHashTable(ht);
+}
+
+static void benchmarkBulk(char** keys, int count) {
+    printf("Bulk load (%d keys):\n", count);
+    HashTableEntry* entries = (HashTableEntry*)malloc(count * sizeof(HashTableEntry));
+    for (int i = 0; i < count; i++) {
+        entries[i].key = keys[i];
+        entries[i].keyLength = strlen(keys[i]);
+        entries[i].value = keys[i];
+    }
+    benchmarkBulkMode("insert() loop", 0, entries, keys, count);
+    benchmarkBulkMode("bulkLoad()", 1, entries, keys, count);
+    benchmarkBulkMode("bulkLoad(assumeUnique)", 2, entries, keys, count);
+    benchmarkBulkMode("  ... with a node pool", 3, entries, keys, count);
+    free(entries);
+}
+
+/**
+ * Replay a scan-polluted trace against a cache with one eviction policy
+ * 
+ * Each operation is a get(), followed by an insert() on a miss. 70% of
+ * the lookups are skewed towards the start of the corpus (index = n * u^3
+ * for a uniform u), the rest walk through the whole corpus in order, the
+ * way a backup or an analytics query would.
+ */
+static void benchmarkEvictionPolicy(const char* name, EvictionPolicy policy, char** keys, int count) {
+    HashTable* ht = createHashTable(16);
+    setCacheLimits(ht, count / 10 > 0 ? count / 10 : 1, 0, NULL, NULL, NULL);
+    setEvictionPolicy(ht, policy);
+
+    const int operations = 2000000;
+    unsigned int seed = 2463534242u;
+    int scan = 0;
+    long hits = 0;
+    double start = nowSeconds();
+    for (int i = 0; i < operations; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        const char* key;
+        if (seed % 10 < 7) {
+            double u = (double)(seed >> 8) / (double)(1u << 24);
+            key = keys[(int)(count * u * u * u)];
+        } else {
+            key = keys[scan];
+            scan = scan + 1 < count ? scan + 1 : 0;
+        }
+        if (get(ht, key) != NULL) {
+            hits++;
+        } else {
+            insert(ht, key, (void*)key);
+        }
+    }
+    double elapsed = nowSeconds() - start;
+
+    printf("  %-8s hit ratio %6.2f%% %7.2f ns/op\n", name, 100.0 * hits / operations, elapsed * 1e9 / operations);
+    freeHashTable(ht);
+}
+
+static void benchmarkEviction(char** keys, int count) {
+    printf("Eviction policies (%d keys, cache holds %d):\n", count, count / 10);
+    benchmarkEvictionPolicy("lru", EVICT_LRU, keys, count);
+    benchmarkEvictionPolicy("clock", EVICT_CLOCK, keys, count);
+    benchmarkEvictionPolicy("s3fifo", EVICT_S3FIFO, keys, count);
+    benchmarkEvictionPolicy("tinylfu", EVICT_TINYLFU, keys, count);
+}
+
+// The benchmark's stand-in for the expiry clock, advanced by hand
+static uint64_t benchClockMs;
+
+static uint64_t benchClock(void) {
+    return benchClockMs;
+}
+
+/**
+ * Expire a whole corpus inserted with TTLs spread over 30 seconds
+ * 
+ * The clock is advanced in 100 ms steps with one activeExpireCycle() per
+ * step, the way a server's timer would drive it; half of the keys are
+ * then inserted again and reclaimed lazily by get() instead.
+ */
+static void benchmarkExpire(char** keys, int count) {
+    printf("Entry expiry (%d keys, TTLs spread over 30 s):\n", count);
+
+    HashTable* ht = createHashTable(16);
+    benchClockMs = 1000;
+    setExpiryClock(ht, benchClock);
+    for (int i = 0; i < count; i++) {
+        insertWithTtl(ht, keys[i], keys[i], 1 + (uint64_t)i * 2654435761u % 30000);
+    }
+
+    int expired = 0;
+    int cycles = 0;
+    double start = nowSeconds();
+    while (ht->size > 0) {
+        benchClockMs += 100;
+        expired += activeExpireCycle(ht, 1000000);
+        cycles++;
+    }
+    double active = nowSeconds() - start;
+    printf("  activeExpireCycle() %7.2f ns/key (%d expired in %d cycles)\n", active * 1e9 / expired, expired, cycles);
+
+    for (int i = 0; i < count; i += 2) {
+        insertWithTtl(ht, keys[i], keys[i], 1);
+    }
+    benchClockMs += 100;
+    int missing = 0;
+    start = nowSeconds();
+    for (int i = 0; i < count; i += 2) {
+        missing += get(ht, keys[i]) == NULL;
+    }
+    double lazy = nowSeconds() - start;
+    printf("  lazy get()          %7.2f ns/key (%d expired)\n", lazy * 1e9 / missing, missing);
+    freeHashTable(ht);
+}
+
+/**
+ * Warm start: rebuild a table with insert() vs map a saved table file
+ */
+static void benchmarkMapped(char** keys, int count) {
+    printf("Warm start (%d keys):\n", count);
+    const char* path = "hash_table_bench.tbl";
+
+    HashTable* ht = createHashTable(16);
+    double start = nowSeconds();
+    for (int i = 0; i < count; i++) {
+        insert(ht, keys[i], keys[i]);
+    }
+    double rebuild = nowSeconds() - start;
+
+    start = nowSeconds();
+    bool saved = saveMappedHashTable(ht, path, NULL, NULL);
+    double save = nowSeconds() - start;
+    freeHashTable(ht);
+    if (!saved) {
+        printf("  could not write %s\n", path);
+        return;
+    }
+
+    start = nowSeconds();
+    MappedHashTable* mt = openMappedHashTable(path);
+    double mapping = nowSeconds() - start;
+    int found = 0;
+    start = nowSeconds();
+    for (int i = 0; i < count; i++) {
+        found += mappedGet(mt, keys[i], NULL) != NULL;
+    }
+    double lookups = nowSeconds() - start;
+
+    printf("  rebuild with insert() %9.3f ms\n", rebuild * 1e3);
+    printf("  saveMappedHashTable() %9.3f ms\n", save * 1e3);
+    printf("  openMappedHashTable() %9.3f ms\n", mapping * 1e3);
+    printf("  mappedGet()           %9.2f ns/key (found %d)\n", lookups * 1e9 / count, found);
+    closeMappedHashTable(mt);
+    unlink(path);
+}
+
+/**
+ * Blocking saveMappedHashTable() vs a forked snapshot while the parent
+ * keeps overwriting values
+ */
+static void benchmarkSnapshot(char** keys, int count) {
+    printf("Snapshots (%d keys):\n", count);
+    const char* path = "hash_table_bench.tbl";
+
+    HashTable* ht = createHashTable(16);
+    for (int i = 0; i < count; i++) {
+        insert(ht, keys[i], keys[i]);
+    }
+
+    double start = nowSeconds();
+    saveMappedHashTable(ht, path, NULL, NULL);
+    printf("  saveMappedHashTable() blocks for %9.3f ms\n", (nowSeconds() - start) * 1e3);
+
+    SnapshotJob job;
+    start = nowSeconds();
+    if (!snapshotAsync(ht, path, NULL, NULL, &job)) {
+        printf("  fork() failed\n");
+        freeHashTable(ht);
+        return;
+    }
+    double forking = nowSeconds() - start;
+    long operations = 0;
+    while (!pollSnapshot(&job, false)) {
+        for (int i = 0; i < 1000; i++, operations++) {
+            const char* key = keys[operations % count];
+            insert(ht, key, (void*)key);
+        }
+    }
+    printf("  snapshotAsync() blocks for     %9.3f ms, child done in %.3f ms (%s)\n",
+           forking * 1e3, job.seconds * 1e3, job.succeeded ? "ok" : "failed");
+    printf("  parent ran %ld inserts meanwhile, %ld minor faults (child %ld)\n",
+           operations, job.parentMinorFaults, job.childMinorFaults);
+    freeHashTable(ht);
+    unlink(path);
+}
+
+// Free a value the replay replaced or deleted (the values are malloc'd copies)
+static void benchmarkDiscard(const char* key, size_t length, void* value, void* context) {
+    (void)key;
+    (void)length;
+    (void)context;
+    free(value);
+}
+
+// Replay a log into a fresh table, returning the seconds it took
+static double benchmarkReplay(const char* path, long* records) {
+    HashTable* ht = createHashTable(16);
+    double start = nowSeconds();
+    *records = replayJournal(ht, path, NULL, benchmarkDiscard, NULL);
+    double elapsed = nowSeconds() - start;
+    HashTableIterator it;
+    initHashTableIterator(&it, ht);
+    const char* key;
+    size_t length;
+    void* value;
+    while (nextHashTableEntry(&it, &key, &length, &value)) {
+        free(value);
+    }
+    freeHashTable(ht);
+    return elapsed;
+}
+
+/**
+ * Insert cost with no journal, a sync per change and group commits
+ */
+static void benchmarkJournalMode(const char* name, int groupOps, char** keys, int count) {
+    const char* path = "hash_table_bench.log";
+    unlink(path);
+    HashTable* ht = createHashTable(16);
+    if (groupOps > 0) {
+        enableJournal(ht, path, groupOps, 0, NULL, NULL);
+    }
+    double start = nowSeconds();
+    for (int i = 0; i < count; i++) {
+        insert(ht, keys[i], keys[i]);
+    }
+    flushJournal(ht);
+    double elapsed = nowSeconds() - start;
+    freeHashTable(ht);
+    printf("  %-16s %9.2f ns/insert\n", name, elapsed * 1e9 / count);
+}
+
+static void benchmarkJournal(char** keys, int count) {
+    // A sync per change is slow enough that a slice of the corpus will do
+    int synced = count < 2000 ? count : 2000;
+    printf("Append-only journal (%d keys, %d with a sync per insert):\n", count, synced);
+    benchmarkJournalMode("no journal", 0, keys, count);
+    benchmarkJournalMode("sync per insert", 1, keys, synced);
+    benchmarkJournalMode("group of 64", 64, keys, count);
+    benchmarkJournalMode("group of 1024", 1024, keys, count);
+
+    long replayed;
+    double elapsed = benchmarkReplay("hash_table_bench.log", &replayed);
+    printf("  replayJournal()  %9.2f ns/record (%ld records)\n", elapsed * 1e9 / (replayed > 0 ? replayed : 1), replayed);
+    unlink("hash_table_bench.log");
+}
+
+/**
+ * Replay time of a log holding five writes per key, before and after a
+ * background rewrite that runs while the parent keeps writing
+ */
+static void benchmarkRewrite(char** keys, int count) {
+    printf("Journal rewrite (%d keys, each written 5 times):\n", count);
+    const char* path = "hash_table_bench.log";
+    unlink(path);
+    HashTable* ht = createHashTable(16);
+    enableJournal(ht, path, 1024, 0, NULL, NULL);
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < count; i++) {
+            insert(ht, keys[i], keys[i]);
+        }
+    }
+    flushJournal(ht);
+    long records;
+    double before = benchmarkReplay(path, &records);
+    printf("  replay before    %9.3f ms (%ld records)\n", before * 1e3, records);
+
+    double start = nowSeconds();
+    rewriteJournalAsync(ht);
+    long operations = 0;
+    bool succeeded = false;
+    while (!pollJournalRewrite(ht, false, &succeeded)) {
+        for (int i = 0; i < 1000; i++, operations++) {
+            const char* key = keys[operations % count];
+            insert(ht, key, (void*)key);
+        }
+    }
+    double rewrite = nowSeconds() - start;
+    flushJournal(ht);
+    printf("  rewrite          %9.3f ms (%s, %ld inserts meanwhile)\n", rewrite * 1e3, succeeded ? "ok" : "failed", operations);
+    freeHashTable(ht);
+
+    double after = benchmarkReplay(path, &records);
+    printf("  replay after     %9.3f ms (%ld records)\n", after * 1e3, records);
+    unlink(path);
+}
+
+/**
+ * Shared state of one multi-threaded benchmark run
+ * 
+ * Each thread performs a mix of 90% lookups and 10% inserts over the
+ * corpus through a ConcurrentHashTable, a SplitOrderedTable, a
+ * ShardedHashTable, or a plain HashTable behind one global mutex (the
+ * baseline).
+ */
+typedef struct ThreadBenchmark {
+    char** keys;
+    int count;
+    int opsPerThread;
+    ConcurrentHashTable* cht;       // Used when not NULL
+    SplitOrderedTable* sot;         // Else this, when not NULL
+    ShardedHashTable* sht;          // Else this, when not NULL
+    HashTable* ht;                  // Otherwise this, guarded by globalLock
+    pthread_mutex_t globalLock;
+} ThreadBenchmark;
+
+typedef struct ThreadBenchmarkArgs {
+    ThreadBenchmark* bench;
+    unsigned int seed;
+} ThreadBenchmarkArgs;
+
+static void* threadBenchmarkWorker(void* arg) {
+    ThreadBenchmarkArgs* args = (ThreadBenchmarkArgs*)arg;
+    ThreadBenchmark* bench = args->bench;
+    unsigned int seed = args->seed;
+
+    for (int i = 0; i < bench->opsPerThread; i++) {
+        seed = seed * 1103515245u + 12345u;
+        char* key = bench->keys[(seed >> 8) % (unsigned int)bench->count];
+        bool write = (seed >> 4) % 10 == 0;
+
+        if (bench->cht != NULL) {
+            if (write) concurrentInsert(bench->cht, key, key);
+            else concurrentGet(bench->cht, key);
+        } else if (bench->sot != NULL) {
+            if (write) splitOrderedInsert(bench->sot, key, key);
+            else splitOrderedGet(bench->sot, key);
+        } else if (bench->sht != NULL) {
+            if (write) shardedInsert(bench->sht, key, key);
+            else shardedGet(bench->sht, key);
+        } else {
+            pthread_mutex_lock(&bench->globalLock);
+            if (write) insert(bench->ht, key, key);
+            else get(bench->ht, key);
+            pthread_mutex_unlock(&bench->globalLock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Run the 90/10 workload on the given number of threads
+ * 
+ * @return Throughput in millions of operations per second
+ */
+static double runThreadBenchmark(ThreadBenchmark* bench, int threads) {
+    pthread_t* ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    ThreadBenchmarkArgs* args = (ThreadBenchmarkArgs*)malloc(threads * sizeof(ThreadBenchmarkArgs));
+
+    double start = nowSeconds();
+    for (int t = 0; t < threads; t++) {
+        args[t].bench = bench;
+        args[t].seed = 7919u * (t + 1);
+        pthread_create(&ids[t], NULL, threadBenchmarkWorker, &args[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    double elapsed = nowSeconds() - start;
+
+    free(ids);
+    free(args);
+    return (double)threads * bench->opsPerThread / elapsed / 1e6;
+}
+
+static void benchmarkConcurrent(char** keys, int count) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = cores > 1 ? (int)cores : 1;
+    printf("Multi-threaded 90%% get / 10%% insert (%d keys, %d cores, Mops/s):\n", count, maxThreads);
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        ThreadBenchmark bench = { keys, count, 1000000, NULL, NULL, NULL, NULL, PTHREAD_MUTEX_INITIALIZER };
+
+        bench.ht = createHashTable(count);
+        for (int i = 0; i < count; i++) insert(bench.ht, keys[i], keys[i]);
+        double global = runThreadBenchmark(&bench, threads);
+        freeHashTable(bench.ht);
+        bench.ht = NULL;
+
+        bench.cht = createConcurrentHashTable(count, 0);
+        for (int i = 0; i < count; i++) concurrentInsert(bench.cht, keys[i], keys[i]);
+        double striped = runThreadBenchmark(&bench, threads);
+        freeConcurrentHashTable(bench.cht);
+        bench.cht = NULL;
+
+        bench.sot = createSplitOrderedTable();
+        for (int i = 0; i < count; i++) splitOrderedInsert(bench.sot, keys[i], keys[i]);
+        double splitOrdered = runThreadBenchmark(&bench, threads);
+        freeSplitOrderedTable(bench.sot);
+        bench.sot = NULL;
+
+        bench.sht = createShardedHashTable(count, 0, true);  // Inserts only: the pool never has to reclaim
+        for (int i = 0; i < count; i++) shardedInsert(bench.sht, keys[i], keys[i]);
+        double sharded = runThreadBenchmark(&bench, threads);
+        freeShardedHashTable(bench.sht);
+
+        printf("  %3d threads: global mutex %7.2f  striped %7.2f  split-ordered %7.2f  sharded %7.2f\n",
+               threads, global, striped, splitOrdered, sharded);
+        if (threads < maxThreads && threads * 2 > maxThreads) {
+            threads = maxThreads / 2;  // Always finish with every core busy
+        }
+    }
+}
+
+#define STRESS_KEYS 4096
+#define STRESS_OPS_PER_THREAD 200000
+
+/**
+ * Shared state of one multi-threaded consistency check
+ * 
+ * Every value stored is the key string itself, so a lookup that returns
+ * anything other than NULL or its own key has seen a torn or recycled node.
+ */
+typedef struct StressCheck {
+    char** keys;
+    int count;
+    int threads;
+    ConcurrentHashTable* cht;       // Used when not NULL
+    SplitOrderedTable* sot;         // Else this, when not NULL
+    ShardedHashTable* sht;          // Otherwise this
+    long mismatches;                // Lookups that returned another key's value
+    pthread_barrier_t churned;      // Every thread has finished the random phase
+} StressCheck;
+
+typedef struct StressArgs {
+    StressCheck* check;
+    int thread;
+} StressArgs;
+
+static void stressInsert(StressCheck* check, char* key) {
+    if (check->cht != NULL) concurrentInsert(check->cht, key, key);
+    else if (check->sot != NULL) splitOrderedInsert(check->sot, key, key);
+    else shardedInsert(check->sht, key, key);
+}
+
+static void stressDelete(StressCheck* check, char* key) {
+    if (check->cht != NULL) concurrentDelete(check->cht, key);
+    else if (check->sot != NULL) splitOrderedDelete(check->sot, key);
+    else shardedDelete(check->sht, key);
+}
+
+static void* stressGet(StressCheck* check, char* key) {
+    if (check->cht != NULL) return concurrentGet(check->cht, key);
+    if (check->sot != NULL) return splitOrderedGet(check->sot, key);
+    return shardedGet(check->sht, key);
+}
+
+/**
+ * Churn the shared key set, then settle this thread's share of it
+ * 
+ * The random phase mixes 50% lookups, 25% inserts and 25% deletes over
+ * every key, so threads race on the same chains and through resizes. Once
+ * all threads are done with it, thread t owns the keys with
+ * index % threads == t and leaves the even ones present and the odd ones
+ * absent.
+ */
+static void* stressWorker(void* arg) {
+    StressArgs* args = (StressArgs*)arg;
+    StressCheck* check = args->check;
+    unsigned int seed = 7919u * (args->thread + 1);
+    long mismatches = 0;
+
+    for (int i = 0; i < STRESS_OPS_PER_THREAD; i++) {
+        seed = seed * 1103515245u + 12345u;
+        char* key = check->keys[(seed >> 8) % (unsigned int)check->count];
+        switch ((seed >> 4) % 4) {
+            case 0: stressInsert(check, key); break;
+            case 1: stressDelete(check, key); break;
+            default: {
+                void* value = stressGet(check, key);
+                if (value != NULL && value != key) mismatches++;
+                break;
+            }
+        }
+    }
+
+    pthread_barrier_wait(&check->churned);
+    for (int i = args->thread; i < check->count; i += check->threads) {
+        if (i % 2 == 0) stressInsert(check, check->keys[i]);
+        else stressDelete(check, check->keys[i]);
+    }
+
+    __atomic_add_fetch(&check->mismatches, mismatches, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * Run the check on one table and verify what is left in it
+ * 
+ * @return true if every lookup was consistent and exactly the even keys remain
+ */
+static bool runStressCheck(const char* name, StressCheck* check) {
+    pthread_t* ids = (pthread_t*)malloc(check->threads * sizeof(pthread_t));
+    StressArgs* args = (StressArgs*)malloc(check->threads * sizeof(StressArgs));
+
+    check->mismatches = 0;
+    pthread_barrier_init(&check->churned, NULL, check->threads);
+    double start = nowSeconds();
+    for (int t = 0; t < check->threads; t++) {
+        args[t].check = check;
+        args[t].thread = t;
+        pthread_create(&ids[t], NULL, stressWorker, &args[t]);
+    }
+    for (int t = 0; t < check->threads; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    double elapsed = nowSeconds() - start;
+    pthread_barrier_destroy(&check->churned);
+
+    long wrong = 0;
+    for (int i = 0; i < check->count; i++) {
+        void* expected = i % 2 == 0 ? check->keys[i] : NULL;
+        if (stressGet(check, check->keys[i]) != expected) wrong++;
+    }
+    long size = check->cht != NULL ? concurrentSize(check->cht)
+              : check->sot != NULL ? (long)splitOrderedSize(check->sot)
+              : shardedSize(check->sht);
+    long expectedSize = (check->count + 1) / 2;
+    bool passed = check->mismatches == 0 && wrong == 0 && size == expectedSize;
+
+    printf("  %-14s %s (%9.3f ms, %ld bad lookups, %ld wrong keys, size %ld of %ld)\n", name,
+           passed ? "ok    " : "FAILED", elapsed * 1e3, check->mismatches, wrong, size, expectedSize);
+    free(ids);
+    free(args);
+    return passed;
+}
+
+/**
+ * Check the concurrent tables for lost updates and torn reads
+ * 
+ * Not a benchmark: it exits non-zero on failure. Build it with
+ * -fsanitize=thread (or address) to also catch data races and
+ * use-after-free, and run it on a multi-core host so the threads really
+ * overlap. The tables start small so that growth races with the churn.
+ * 
+ * @return true if every table passed
+ */
+static bool checkConcurrentConsistency(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cores > 4 ? (int)cores : 4;  // Oversubscribe small hosts to force preemption mid-operation
+    char** keys = (char**)malloc(STRESS_KEYS * sizeof(char*));
+    char key[32];
+    bool passed = true;
+
+    for (int i = 0; i < STRESS_KEYS; i++) {
+        snprintf(key, sizeof(key), "stress:%d", i);
+        keys[i] = strdup(key);
+    }
+    printf("Multi-threaded insert/delete/get consistency (%d keys, %d threads):\n", STRESS_KEYS, threads);
+
+    StressCheck check = { .keys = keys, .count = STRESS_KEYS, .threads = threads };
+    check.cht = createConcurrentHashTable(16, 0);
+    passed &= runStressCheck("striped", &check);
+    freeConcurrentHashTable(check.cht);
+    check.cht = NULL;
+
+    check.sot = createSplitOrderedTable();
+    passed &= runStressCheck("split-ordered", &check);
+    freeSplitOrderedTable(check.sot);
+    check.sot = NULL;
+
+    check.sht = createShardedHashTable(16, 0, false);
+    passed &= runStressCheck("sharded", &check);
+    freeShardedHashTable(check.sht);
+
+    freeKeys(keys, STRESS_KEYS);
+    return passed;
+}
+
+int main(int argc, char* argv[]) {
+    const char* which = argc > 1 ? argv[1] : "all";
+    int count;
+    char** keys = loadKeys(argc > 2 ? argv[2] : NULL, &count);
+    bool all = strcmp(which, "all") == 0;
+    bool passed = true;
+
+    if (all || strcmp(which, "hash") == 0) {
+        benchmarkHash(keys, count);
+    }
+    if (all || strcmp(which, "index") == 0) {
+        benchmarkIndex(keys, count);
+    }
+    if (all || strcmp(which, "batch") == 0) {
+        benchmarkBatch(keys, count);
+    }
+    if (all || strcmp(which, "swiss") == 0) {
+        benchmarkSwiss(keys, count);
+    }
+    if (all || strcmp(which, "robinhood") == 0) {
+        benchmarkRobinHood(keys, count);
+    }
+    if (all || strcmp(which, "pool") == 0) {
+        benchmarkPool(keys, count);
+    }
+    if (all || strcmp(which, "bulk") == 0) {
+        benchmarkBulk(keys, count);
+    }
+    if (all || strcmp(which, "eviction") == 0) {
+        benchmarkEviction(keys, count);
+    }
+    if (all || strcmp(which, "expire") == 0) {
+        benchmarkExpire(keys, count);
+    }
+    if (all || strcmp(which, "mapped") == 0) {
+        benchmarkMapped(keys, count);
+    }
+    if (all || strcmp(which, "snapshot") == 0) {
+        benchmarkSnapshot(keys, count);
+    }
+    if (all || strcmp(which, "journal") == 0) {
+        benchmarkJournal(keys, count);
+    }
+    if (all || strcmp(which, "rewrite") == 0) {
+        benchmarkRewrite(keys, count);
+    }
+    if (all || strcmp(which, "concurrent") == 0) {
+        benchmarkConcurrent(keys, count);
+    }
+    if (all || strcmp(which, "stress") == 0) {
+        passed = checkConcurrentConsistency();
+    }
+
+    freeKeys(keys, count);
+    return passed ? 0 : 1;
+}
+#endif